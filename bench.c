@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "customer.h"
+#include "rng.h"
+#include "sim.h"
+#include "vsim.h"
+#include "trace.h"
+#include "dist.h"
+
+//Queue depths the hold benchmark is run at
+static const int depths[] = {16, 256, 4096, 65536};
+#define DEPTHS (int)(sizeof(depths)/sizeof(depths[0]))
+//Variates drawn per RNG benchmark, and per batch fill
+#define RNG_OPS       (1L << 23)
+#define RNG_BATCH     256
+//Variates compared by the accuracy check, and its bounds
+#define CHECK_N       (1 << 20)
+#define CHECK_ULPS    4
+#define CHECK_KS      1.95
+//Random123 known answers for Philox4x32-10: counter, key and output
+static const unsigned int philox_kat[][10] = {
+    {0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+     0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+    {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+     0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+    {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
+     0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+#define KATS (int)(sizeof(philox_kat)/sizeof(philox_kat[0]))
+//Largest thread count of the contention benchmark
+#define THREADS_MAX   64
+//Distributions the sampler benchmark draws from, the empirical one
+//is read from a generated histogram
+static const char* shapes[] = {"exp", "det", "erlang:4", "hyper:4", "lognormal:2", "pareto:1.5", "empirical"};
+#define SHAPES (int)(sizeof(shapes)/sizeof(shapes[0]))
+#define HISTOGRAM_BINS 4096
+//Enqueue/dequeue pairs shared out between the contending threads
+#define CONTENDED_OPS (1L << 21)
+//Customers drawn and returned per allocator benchmark
+#define ALLOC_OPS     (1L << 22)
+//Customers run through each end-to-end benchmark, and server counts
+#define ENGINE_OPS    1000000
+static const int pools[] = {1, 16, 1024};
+#define POOLS (int)(sizeof(pools)/sizeof(pools[0]))
+//Layout of the lines below, bumped whenever a column changes meaning
+#define BENCH_FORMAT  1
+
+//Contention thread input structure
+typedef struct _contend_data {
+    cqueue*          queue;           //Reference to the shared queue
+    pthread_mutex_t* lock;            //Reference to queue mutex, NULL for lock-free queues
+    cid              own;             //Customer the thread starts out holding
+    long             ops;             //Number of enqueue/dequeue pairs to run
+} contend_data;
+
+//Prototypes
+static double _now(void);
+static void   _report(const char* bench, const char* variant, long param, long ops, double seconds);
+static const char* _mode_name(cqmode m);
+static void   bench_hold(cqmode mode, int depth, int accounted);
+static void   bench_contention(cqmode mode, int threads);
+static void   bench_alloc(int batch);
+static void   bench_rng(void);
+static void   bench_dist(const char* spec);
+static void   bench_engine(cqmode mode, int servers, int replay);
+static double _zero_clock(void* arg);
+static int    check_philox(void);
+static int    check_rng(rngsimd level);
+static int    _cmp_double(const void* a, const void* b);
+static void*  _contend(void* targ);
+
+int main(int argc, char** argv)
+{
+    int i, bad = 0;
+    //Accuracy of the batch kernels comes first, as comment lines
+    printf("# bench_format %d cores=%ld simd=%d\n", BENCH_FORMAT,
+           sysconf(_SC_NPROCESSORS_ONLN), (int)rng_simd_level());
+    bad += check_philox();
+    for(i = RNG_SCALAR; i <= rng_simd_level(); i++)
+        bad += check_rng((rngsimd)i);
+    printf("benchmark\tvariant\tparam\tops\tns_per_op\n");
+    for(i = 0; i < DEPTHS; i++) {
+        bench_hold(FIFO,    depths[i], 0);
+        bench_hold(FIFO,    depths[i], 1);
+        bench_hold(SJF,     depths[i], 0);
+        bench_hold(SJFLIST, depths[i], 0);
+    }
+    for(i = 1; i <= THREADS_MAX; i *= 2) {
+        bench_contention(FIFO, i);
+        bench_contention(RING, i);
+    }
+    for(i = 1; i <= 4096; i *= 64)
+        bench_alloc(i);
+    bench_rng();
+    for(i = 0; i < SHAPES; i++)
+        bench_dist(shapes[i]);
+    for(i = 0; i < POOLS; i++) {
+        bench_engine(FIFO,    pools[i], 0);
+        bench_engine(SJF,     pools[i], 0);
+        bench_engine(SJFLIST, pools[i], 0);
+        bench_engine(FIFO,    pools[i], 1);
+        bench_engine(SRPT,    pools[i], 0);
+        bench_engine(RR,      pools[i], 0);
+        bench_engine(PRIO,    pools[i], 0);
+    }
+    return bad ? 1 : 0;
+}
+
+double _now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1000000000.0;
+}
+
+void _report(const char* b, const char* v, long p, long ops, double s) {
+    printf("%s\t%s\t%ld\t%ld\t%.2lf\n", b, v, p, ops, 1e9*s/ops);
+    fflush(stdout);
+}
+
+const char* _mode_name(cqmode m) {
+    switch(m) {
+        case FIFO   : return "fifo";
+        case SJF    : return "sjf";
+        case SJFLIST: return "sjf_list";
+        case RING   : return "ring";
+        default     : break;
+    }
+    return cqmode_disc(m) ? cqmode_disc(m)->name : "unknown";
+}
+
+//Classic hold model: the queue sits at a fixed depth while each
+//operation dequeues one customer and enqueues a fresh job, optionally
+//with time weighted length accounting switched on
+void bench_hold(cqmode mode, int depth, int accounted) {
+    carena*   a = new_carena(depth);
+    cqueue*   q = new_cqueue(mode, a);
+    cid       c;
+    rng       random;
+    long      i, ops;
+    double    start;
+    char      variant[32];
+
+    rng_seed(&random, 1, 0);
+    if(accounted)
+        cqueue_account(q, _zero_clock, NULL);
+
+    //The list SJF is linear in depth, keep its runs bounded
+    ops = (mode == SJFLIST) ? (1L << 24)/depth : 1000000;
+    if(ops < 1000) ops = 1000;
+
+    for(i = 0; i < depth; i++) {
+        c = carena_get(a);
+        a->job[c] = a->left[c] = rng_exp(&random, 1.0);
+        encqueue(q, c);
+    }
+    start = _now();
+    for(i = 0; i < ops; i++) {
+        c = decqueue(q);
+        a->job[c] = a->left[c] = a->job[c] + rng_exp(&random, 1.0);
+        encqueue(q, c);
+    }
+    snprintf(variant, sizeof(variant), "%s%s", _mode_name(mode), accounted ? "_accounted" : "");
+    _report("hold", variant, depth, ops, _now()-start);
+    destroy_cqueue(q);
+    destroy_carena(a);
+}
+
+double _zero_clock(void* arg) {
+    return 0;
+}
+
+//Every thread passes customers through one shared queue, the FIFO list
+//behind a mutex the way main.c guards live, or the lock-free ring
+void bench_contention(cqmode mode, int threads) {
+    carena*         a = new_carena(2*THREADS_MAX + threads);
+    cqueue*         q = new_cqueue(mode, a);
+    pthread_mutex_t lock;
+    pthread_t       tids[THREADS_MAX];
+    contend_data    data[THREADS_MAX];
+    double          start;
+    int i;
+
+    pthread_mutex_init(&lock, NULL);
+    //Spare customers keep consumers from finding the queue empty
+    for(i = 0; i < 2*THREADS_MAX; i++)
+        encqueue(q, carena_get(a));
+    for(i = 0; i < threads; i++) {
+        data[i].queue = q;
+        data[i].lock  = (mode == RING) ? NULL : &lock;
+        data[i].own   = carena_get(a);
+        data[i].ops   = CONTENDED_OPS/threads;
+    }
+    start = _now();
+    for(i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, _contend, &data[i]);
+    for(i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    _report("contention", (mode == RING) ? "ring" : "fifo_mutex", threads,
+            data[0].ops*threads, _now()-start);
+
+    destroy_cqueue(q);
+    destroy_carena(a);
+    pthread_mutex_destroy(&lock);
+}
+
+void* _contend(void* targ) {
+    contend_data* d = (contend_data*)targ;
+    cid c = d->own;
+    long i;
+    for(i = 0; i < d->ops; i++) {
+        if(d->lock) {
+            pthread_mutex_lock(d->lock);
+            encqueue(d->queue, c);
+            pthread_mutex_unlock(d->lock);
+            pthread_mutex_lock(d->lock);
+            c = decqueue(d->queue);
+            pthread_mutex_unlock(d->lock);
+        } else {
+            encqueue(d->queue, c);
+            //Ring can look empty while a producer is mid-publish
+            while((c = decqueue(d->queue)) == CID_NONE)
+                sched_yield();
+        }
+    }
+    d->own = c;
+    return NULL;
+}
+
+//Allocator churn: draw a batch of customers from the arena and hand
+//them all back
+void bench_alloc(int batch) {
+    carena* a    = new_carena(batch);
+    cid*    held = (cid*)malloc(batch*sizeof(cid));
+    long    i;
+    int     j;
+    double  start;
+
+    start = _now();
+    for(i = 0; i < ALLOC_OPS; i += batch) {
+        for(j = 0; j < batch; j++)
+            held[j] = carena_get(a);
+        for(j = 0; j < batch; j++)
+            carena_put(a, held[j]);
+    }
+    _report("alloc", "arena", batch, ALLOC_OPS, _now()-start);
+    free(held);
+    destroy_carena(a);
+}
+
+//Exponential variates from the process global drand48, one at a time
+//from a Philox stream, and a block at a time through the batch API
+void bench_rng(void) {
+    double  buf[RNG_BATCH];
+    double  start, sink = 0;
+    rng     random;
+    long    i;
+    int     j, k;
+    const char* fills[] = {"philox_fill_scalar", "philox_fill_avx2", "philox_fill_avx512"};
+
+    srand48(1);
+    start = _now();
+    for(i = 0; i < RNG_OPS; i++)
+        sink += -log(1.0-drand48());
+    _report("rng_exp", "drand48", 1, RNG_OPS, _now()-start);
+
+    rng_seed(&random, 1, 0);
+    start = _now();
+    for(i = 0; i < RNG_OPS; i++)
+        sink += rng_exp(&random, 1.0);
+    _report("rng_exp", "philox", 1, RNG_OPS, _now()-start);
+
+    for(k = RNG_SCALAR; k <= rng_simd_level(); k++) {
+        start = _now();
+        for(i = 0; i < RNG_OPS; i += RNG_BATCH) {
+            rng_exp_fill_with(&random, 1.0, buf, RNG_BATCH, (rngsimd)k);
+            for(j = 0; j < RNG_BATCH; j++)
+                sink += buf[j];
+        }
+        _report("rng_exp", fills[k], RNG_BATCH, RNG_OPS, _now()-start);
+    }
+
+    //Keep the sums alive so the loops aren't optimized away
+    if(sink < 0)
+        printf("%lf\n", sink);
+}
+
+//Unit mean variates drawn through dist_next(), the way both engines draw
+//interarrival times and jobs
+void bench_dist(const char* spec) {
+    char     path[] = "/tmp/iq-bench-XXXXXX";
+    char     name[64];
+    double   start, sink = 0;
+    FILE*    out;
+    dist*    d;
+    expblock draws;
+    rng      random;
+    long     i;
+    int      fd;
+
+    //A long tailed histogram makes the alias table work for its keep
+    if(!strcmp(spec, "empirical")) {
+        if((fd = mkstemp(path)) < 0 || (out = fdopen(fd, "w")) == NULL) {
+            printf("# dist empirical skipped, histogram in %s failed\n", path);
+            return;
+        }
+        for(i = 1; i <= HISTOGRAM_BINS; i++)
+            fprintf(out, "%ld %.6lf\n", i, exp(-i/64.0) + 1.0/i);
+        fclose(out);
+        snprintf(name, sizeof(name), "empirical:%s", path);
+        d = new_dist(name);
+        unlink(path);
+    } else {
+        d = new_dist(spec);
+    }
+    if(d == NULL) {
+        printf("# dist %s skipped, it failed to build\n", spec);
+        return;
+    }
+
+    rng_seed(&random, 1, 0);
+    expblock_init(&draws, &random);
+    start = _now();
+    for(i = 0; i < RNG_OPS; i++)
+        sink += dist_next(d, &draws);
+    _report("dist", spec, d->cells, RNG_OPS, _now()-start);
+    if(fabs(sink/RNG_OPS - 1) > 0.05)
+        printf("# dist %s mean=%.6lf is off\n", spec, sink/RNG_OPS);
+    destroy_dist(d);
+}
+
+//Compares a batch kernel against rng_exp() drawing the same stream one
+//at a time with libm's log: every variate must agree to CHECK_ULPS and
+//the sample must pass a Kolmogorov-Smirnov test against Exp(1)
+//The scalar block against the reference vectors, the batch kernels are
+//held to the scalar path by check_rng
+int check_philox(void) {
+    unsigned int out[4];
+    int i, failed = 0;
+    for(i = 0; i < KATS; i++) {
+        rng_block(&philox_kat[i][0], &philox_kat[i][4], out);
+        failed += memcmp(out, &philox_kat[i][6], sizeof(out)) != 0;
+    }
+    printf("# rng_kat philox4x32-10 vectors=%d failed=%d %s\n", KATS, failed, failed ? "FAIL" : "ok");
+    return failed;
+}
+
+int check_rng(rngsimd level) {
+    const char* names[] = {"scalar", "avx2", "avx512"};
+    double* ref = (double*)malloc(CHECK_N*sizeof(double));
+    double* got = (double*)malloc(CHECK_N*sizeof(double));
+    double  err, worst = 0, sum = 0, ks = 0, d;
+    rng     random;
+    int     i, bad;
+
+    rng_seed(&random, 42, 7);
+    for(i = 0; i < CHECK_N; i++)
+        ref[i] = rng_exp(&random, 1.0);
+    rng_seed(&random, 42, 7);
+    rng_exp_fill_with(&random, 1.0, got, CHECK_N, level);
+
+    for(i = 0; i < CHECK_N; i++) {
+        err = fabs(got[i]-ref[i])/ref[i];
+        if(err > worst) worst = err;
+        sum += got[i];
+    }
+    qsort(got, CHECK_N, sizeof(double), _cmp_double);
+    for(i = 0; i < CHECK_N; i++) {
+        d = fabs((i+1)/(double)CHECK_N - (1.0-exp(-got[i])));
+        if(d > ks) ks = d;
+    }
+    ks *= sqrt((double)CHECK_N);
+    bad = worst > CHECK_ULPS*2.220446049250313e-16 || ks > CHECK_KS;
+    printf("# rng_accuracy %s max_rel_err=%.3e mean=%.6lf ks=%.4lf %s\n",
+           names[level], worst, sum/CHECK_N, ks, bad ? "FAIL" : "ok");
+    free(ref);
+    free(got);
+    return bad;
+}
+
+//End-to-end customers per second through the virtual time engine at
+//80% load, drawing the workload or replaying it from a trace
+void bench_engine(cqmode mode, int servers, int replay) {
+    simconfig  cfg;
+    simresult* res = new_simresult(servers);
+    char       path[] = "/tmp/iq-bench-XXXXXX";
+    char       variant[32];
+    double     start;
+    int        fd = -1;
+
+    cfg.mu        = 4.0;
+    cfg.lambda    = 0.8*cfg.mu*servers;
+    cfg.rseed     = 1;
+    cfg.stream    = 0;
+    cfg.arrivals  = NULL;
+    cfg.service   = NULL;
+    cfg.profile   = NULL;
+    cfg.customers = ENGINE_OPS;
+    cfg.precision = 0;
+    cfg.servers   = servers;
+    cfg.replay    = NULL;
+    cfg.record    = NULL;
+    simconfig_mode(&cfg, mode, 0);
+    //Record the workload once, only the replay is timed
+    if(replay) {
+        if((fd = mkstemp(path)) < 0 || (cfg.record = trace_create(path, TRACE_FIXED)) == NULL ||
+           vsim_run(&cfg, res) || trace_close(cfg.record) || (cfg.replay = trace_open(path)) == NULL) {
+            printf("# engine replay skipped, trace in %s failed\n", path);
+            if(fd >= 0) { close(fd); unlink(path); }
+            destroy_simresult(res);
+            return;
+        }
+        cfg.record = NULL;
+    }
+    start = _now();
+    vsim_run(&cfg, res);
+    snprintf(variant, sizeof(variant), "virtual_%s%s", _mode_name(mode), replay ? "_replay" : "");
+    _report("engine", variant, servers, res->analyzed, _now()-start);
+    if(replay) {
+        trace_unmap(cfg.replay);
+        close(fd);
+        unlink(path);
+    }
+    destroy_simresult(res);
+}
+
+int _cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
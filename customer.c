@@ -1,166 +1,767 @@
 #include "customer.h"
 
+#include <sched.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+//Number of slots in a lock-free ring (power of two)
+#define RING_SIZE    65536
+
+//Columns of an arena, each starting on a page of its own
+#define ARENA_PAGE   4096
+
 //The GOOD functions
-static void _encqueue_fifo(cqueue* q, customer* c);
-static void _encqueue_sjf(cqueue* q,  customer* c);
+static void      _encqueue_fifo(cqueue* q, cid c);
+static void      _encqueue_lifo(cqueue* q, cid c);
+static void      _encqueue_sjf(cqueue* q,  cid c);
+static void      _encqueue_heap(cqueue* q, cid c);
+static void      _encqueue_lane(cqueue* q, cid c);
+static void      _encqueue_wait(cqueue* q, cid c);
+static cid       _decqueue_list(cqueue* q);
+static cid       _decqueue_heap(cqueue* q);
+static cid       _decqueue_lane(cqueue* q);
+static cid       _peek_list(cqueue* q);
+static cid       _peek_heap(cqueue* q);
+static cid       _peek_lane(cqueue* q);
+static double    _rank_left(const carena* a, cid c, double left);
+static double    _rank_prio(const carena* a, cid c, double left);
+static int       _encqueue_ring(cqueue* q, cid c);
+static cid       _decqueue_ring(cqueue* q);
+static void      _account(cqueue* q, int change);
+static void      _atomic_add(_Atomic double* a, double v);
+static void*     _column(carena* a, size_t* at, size_t size);
 
-customer* decqueue(cqueue* q) {
-    customer * c = NULL;
+//Every mode's discipline, indexed by mode
+static const cqdisc _discs[CQ_MODES] = {
+    [FIFO]    = {"fifo",      "FIFO",            _encqueue_fifo, _decqueue_list, _peek_list, NULL,       0},
+    [SJF]     = {"sjf",       "SJF",             _encqueue_heap, _decqueue_heap, _peek_heap, NULL,       0},
+    [SJFLIST] = {"sjf_list",  "SJF list",        _encqueue_sjf,  _decqueue_list, _peek_list, NULL,       0},
+    [RING]    = {"fifo_ring", "FIFO, lock-free", _encqueue_wait, _decqueue_ring, NULL,       NULL,       0},
+    [LIFO]    = {"lifo",      "LIFO",            _encqueue_lifo, _decqueue_list, _peek_list, NULL,       0},
+    [SRPT]    = {"srpt",      "SRPT",            _encqueue_heap, _decqueue_heap, _peek_heap, _rank_left, 0},
+    [RR]      = {"rr",        "Round robin",     _encqueue_fifo, _decqueue_list, _peek_list, NULL,       1},
+    [PRIO]    = {"prio",      "Priority",        _encqueue_lane, _decqueue_lane, _peek_lane, _rank_prio, 0},
+};
+
+cid decqueue(cqueue* q) {
+    cid c;
     if(q == NULL)
-        return NULL;
-    if(q->head == NULL)
-        return NULL;
-    c = q->head;
+        return CID_NONE;
+    //Dequeue based on how the mode stores customers
+    c = q->disc->deq(q);
+    if(c != CID_NONE && q->stats != NULL)
+        _account(q, -1);
+    return c;
+}
 
-    q->head = c->next;
-    //This will be true except when there is 1 node left
-    if(q->head != NULL)
-        q->head->prev = NULL;
+cid _decqueue_list(cqueue* q) {
+    cid c = q->head;
+    if(c == CID_NONE)
+        return CID_NONE;
+    q->head = q->arena->next[c];
     q->count--;
 
     //List is now empty reset all
-    if(q->head == NULL) {
-        q->tail  = NULL;
+    if(q->head == CID_NONE) {
+        q->tail  = CID_NONE;
         q->count = 0;
     }
 
     //Don't want any loose ends
-    c->next = NULL;
-    c->prev = NULL;
+    q->arena->next[c] = CID_NONE;
     return c;
 }
 
-void encqueue(cqueue* q, customer* c) {
+void encqueue(cqueue* q, cid c) {
     if(q == NULL)
         return;
     //Enqueue based on what mode passed
-    switch(q->mode) {
-        case FIFO: return _encqueue_fifo(q,c);
-        case SJF : return _encqueue_sjf(q,c);
-        default  : return _encqueue_fifo(q,c);
-    }
+    q->disc->enq(q, c);
+    if(c != CID_NONE && q->stats != NULL)
+        _account(q, 1);
+}
+
+//The customer decqueue would hand out next, CID_NONE when the queue is
+//empty or its mode can't tell without taking it
+cid cqueue_peek(cqueue* q) {
+    if(q == NULL || q->disc->peek == NULL)
+        return CID_NONE;
+    return q->disc->peek(q);
+}
+
+//Take every customer of a FIFO queue at once, as a chain linked by next
+//in queue order
+cid cqueue_detach(cqueue* q) {
+    cid c;
+    if(q == NULL || q->mode != FIFO || q->head == CID_NONE)
+        return CID_NONE;
+    c = q->head;
+    if(q->stats != NULL)
+        _account(q, -q->count);
+    q->head  = CID_NONE;
+    q->tail  = CID_NONE;
+    q->count = 0;
+    return c;
+}
+
+//Move every customer of one FIFO queue to the back of another, both
+//staying in order
+int cqueue_splice(cqueue* q, cqueue* from) {
+    int n;
+    if(q == NULL || from == NULL || q->mode != FIFO || from->mode != FIFO || q->arena != from->arena)
+        return -1;
+    if(from->head == CID_NONE)
+        return 0;
+    n = from->count;
+    if(q->tail == CID_NONE)
+        q->head = from->head;
+    else
+        q->arena->next[q->tail] = from->head;
+    q->tail   = from->tail;
+    q->count += n;
+    cqueue_detach(from);
+    if(q->stats != NULL)
+        _account(q, n);
+    return 0;
 }
 
-cqueue* new_cqueue(cqmode m) {
-    cqueue* q = (cqueue*)malloc(sizeof(cqueue));
+//Queues hold customers of one arena, they link them through its next
+//column and only ever own their own storage
+cqueue* new_cqueue(cqmode m, carena* a) {
+    cqueue* q;
+    void*   heap;
+    int i;
+    if(m < FIFO || m >= CQ_MODES || a == NULL)
+        return NULL;
+    if((q = (cqueue*)malloc(sizeof(cqueue))) == NULL)
+        return NULL;
     q->mode   = m;
-    q->head   = NULL;
-    q->tail   = NULL;
+    q->disc   = &_discs[m];
+    q->arena  = a;
+    q->head   = CID_NONE;
+    q->tail   = CID_NONE;
     q->count  = 0;
+    q->heap   = NULL;
+    q->size   = 0;
+    q->seq    = 0;
+    q->ring   = NULL;
+    q->lanes  = NULL;
+    q->ready  = 0;
+    q->stats  = NULL;
+    if(m == PRIO && (q->lanes = (cqlane*)calloc(CQ_CLASSES, sizeof(cqlane))) == NULL) {
+        free(q);
+        return NULL;
+    }
+    if(m == RING) {
+        q->ring = (cqring*)aligned_alloc(64, sizeof(cqring) + RING_SIZE*sizeof(cqslot));
+        if(q->ring == NULL) {
+            free(q);
+            return NULL;
+        }
+        q->ring->mask = RING_SIZE-1;
+        for(i = 0; i < RING_SIZE; i++) {
+            atomic_init(&q->ring->slots[i].turn, i);
+            q->ring->slots[i].cust = CID_NONE;
+        }
+        atomic_init(&q->ring->enq, 0);
+        atomic_init(&q->ring->deq, 0);
+    }
+    //A heap has a slot for every customer of the arena from the start so
+    //an enqueue never grows it and never fails, like the arena only the
+    //slots written to are backed by memory
+    if(q->disc->enq == _encqueue_heap) {
+        heap = mmap(NULL, (size_t)a->capacity*sizeof(cqentry), PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if(heap == MAP_FAILED) {
+            free(q);
+            return NULL;
+        }
+        q->heap = (cqentry*)heap;
+        q->size = (int)a->capacity;
+    }
     return q;
 }
 
-customer* new_customer(double j, timeval b) {
-    customer* c = (customer*)malloc(sizeof(customer));
-    c->job      = j;
-    c->born     = b;
-    c->next     = NULL;
-    c->prev     = NULL;
-    return c;
+const cqdisc* cqmode_disc(cqmode m) {
+    if(m < FIFO || m >= CQ_MODES)
+        return NULL;
+    return &_discs[m];
 }
 
-customer* new_blank_customer(void) {
-    customer* c = (customer*)malloc(sizeof(customer));
-    c->next     = NULL;
-    c->prev     = NULL;
-    return c;
+//A discipline by name, optionally followed by a colon and an argument
+//(the round robin quantum or the number of priority classes). The old
+//numbers still work, 0 for FIFO and anything else for SJF.
+int cqmode_parse(const char* spec, cqmode* m, double* arg) {
+    const char* colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon-spec) : strlen(spec);
+    char*  end;
+    int    i;
+
+    *arg = 0;
+    if(len > 0 && spec[0] >= '0' && spec[0] <= '9') {
+        i = (int)strtol(spec, &end, 10);
+        if(*end != '\0')
+            return -1;
+        *m = i ? SJF : FIFO;
+        return 0;
+    }
+    //The ring is picked with -F, it is only ever FIFO
+    for(i = 0; i < CQ_MODES; i++)
+        if(i != RING && strlen(_discs[i].name) == len && strncmp(spec, _discs[i].name, len) == 0)
+            break;
+    if(i == CQ_MODES)
+        return -1;
+    *m = (cqmode)i;
+    if(colon == NULL)
+        return 0;
+    if(i != RR && i != PRIO)
+        return -1;
+    *arg = strtod(colon+1, &end);
+    if(end == colon+1 || *end != '\0' || *arg <= 0)
+        return -1;
+    return 0;
 }
 
-void destroy_cqueue(cqueue* q) {
-    customer* i = decqueue(q);
-    while(i != NULL) {
-        destroy_customer(i);
-        i = decqueue(q);
+int cqueue_length(cqueue* q) {
+    if(q == NULL)
+        return 0;
+    //Producers and consumers move the ring tickets concurrently
+    if(q->mode == RING)
+        return (int)(atomic_load(&q->ring->enq) - atomic_load(&q->ring->deq));
+    return q->count;
+}
+
+//Start time weighted accounting of the length from the clock's present,
+//starting over if the queue was already accounting
+int cqueue_account(cqueue* q, cqclock clock, void* arg) {
+    cqstats* s;
+    int i;
+    if(q == NULL)
+        return -1;
+    s = q->stats ? q->stats : (cqstats*)malloc(sizeof(cqstats));
+    if(s == NULL)
+        return -1;
+    s->clock = clock;
+    s->arg   = arg;
+    s->start = clock(arg);
+    atomic_init(&s->length, cqueue_length(q));
+    atomic_init(&s->m1, 0);
+    atomic_init(&s->m2, 0);
+    for(i = 0; i < CQ_LENGTHS; i++)
+        atomic_init(&s->hist[i], 0);
+    q->stats = s;
+    return 0;
+}
+
+//Copy of the accounting so far, for a later run to carry on from
+int cqueue_account_save(cqueue* q, cqstats* into) {
+    cqstats* s;
+    int i;
+    if(q == NULL || (s = q->stats) == NULL)
+        return -1;
+    into->clock = s->clock;
+    into->arg   = s->arg;
+    into->start = s->start;
+    atomic_init(&into->length, atomic_load(&s->length));
+    atomic_init(&into->m1, atomic_load(&s->m1));
+    atomic_init(&into->m2, atomic_load(&s->m2));
+    for(i = 0; i < CQ_LENGTHS; i++)
+        atomic_init(&into->hist[i], atomic_load(&s->hist[i]));
+    return 0;
+}
+
+//Carry on accounting from a saved copy, on a clock that reads on from
+//where the saved one stopped. Whatever the queue holds now against the
+//saved length counts as one change at the clock's present.
+int cqueue_account_from(cqueue* q, cqclock clock, void* arg, const cqstats* from) {
+    cqstats* s;
+    long     n;
+    int      i;
+    if(cqueue_account(q, clock, arg))
+        return -1;
+    s = q->stats;
+    n = atomic_load(&s->length);
+    s->start = from->start;
+    atomic_store(&s->length, atomic_load(&from->length));
+    atomic_store(&s->m1, atomic_load(&from->m1));
+    atomic_store(&s->m2, atomic_load(&from->m2));
+    for(i = 0; i < CQ_LENGTHS; i++)
+        atomic_store(&s->hist[i], atomic_load(&from->hist[i]));
+    if(n != atomic_load(&s->length))
+        _account(q, (int)(n - atomic_load(&s->length)));
+    return 0;
+}
+
+//Time weighted mean and sigma of the length since accounting started,
+//share (if given) receives the fraction of time spent at each length
+int cqueue_length_stats(cqueue* q, double* mean, double* sigma, double* share) {
+    cqstats* s;
+    double   t, l, m, v;
+    int      i, b;
+    if(q == NULL || (s = q->stats) == NULL)
+        return -1;
+    t = s->clock(s->arg) - s->start;
+    l = (double)atomic_load_explicit(&s->length, memory_order_relaxed);
+    if(t <= 0) {
+        *mean  = 0;
+        *sigma = 0;
+        for(i = 0; share != NULL && i < CQ_LENGTHS; i++)
+            share[i] = 0;
+        return 0;
+    }
+    m = (t*l   - atomic_load_explicit(&s->m1, memory_order_relaxed))/t;
+    v = (t*l*l - atomic_load_explicit(&s->m2, memory_order_relaxed))/t - m*m;
+    *mean  = m;
+    *sigma = (v > 0) ? sqrt(v) : 0;
+    b = (l < CQ_LENGTHS-1) ? (int)l : CQ_LENGTHS-1;
+    for(i = 0; share != NULL && i < CQ_LENGTHS; i++)
+        share[i] = ((i == b ? t : 0) - atomic_load_explicit(&s->hist[i], memory_order_relaxed))/t;
+    return 0;
+}
+
+//Length integrated over time from the start of accounting up to the
+//clock's present, at receives the clock's reading
+int cqueue_length_area(cqueue* q, double* at, double* area) {
+    if(q == NULL || q->stats == NULL)
+        return -1;
+    *at   = q->stats->clock(q->stats->arg);
+    *area = cqstats_area(q->stats, *at);
+    return 0;
+}
+
+//Length integrated over time from the start of accounting up to a clock
+//reading no operation in the sums came after
+double cqstats_area(const cqstats* s, double at) {
+    return (at - s->start)*(double)atomic_load_explicit(&s->length, memory_order_relaxed) -
+           atomic_load_explicit(&s->m1, memory_order_relaxed);
+}
+
+//Hand every customer of a queue to visit in the order decqueue would
+//hand them out, heap modes going in slot order instead. Nothing else may
+//touch the queue meanwhile, the ring included.
+void cqueue_walk(cqueue* q, cqvisit visit, void* arg) {
+    unsigned long t, end;
+    cid c;
+    int k;
+    if(q == NULL)
+        return;
+    if(q->mode == RING) {
+        end = atomic_load(&q->ring->enq);
+        for(t = atomic_load(&q->ring->deq); t < end; t++)
+            visit(q->ring->slots[t & q->ring->mask].cust, arg);
+        return;
+    }
+    if(q->heap != NULL) {
+        for(k = 0; k < q->count; k++)
+            visit(q->heap[k].cust, arg);
+        return;
     }
+    //Priority classes are walked one after the other
+    for(k = 0; k < ((q->lanes != NULL) ? CQ_CLASSES : 1); k++)
+        for(c = (q->lanes != NULL) ? q->lanes[k].head : q->head; c != CID_NONE; c = q->arena->next[c])
+            visit(c, arg);
+    return;
+}
+
+//Customers left in the queue stay with the arena, which owns them
+void destroy_cqueue(cqueue* q) {
+    if(q == NULL)
+        return;
+    free(q->stats);
+    if(q->heap != NULL)
+        munmap(q->heap, (size_t)q->size*sizeof(cqentry));
+    free(q->ring);
+    free(q->lanes);
     free(q);
     return;
 }
 
-void destroy_customer(customer* c) {
-    free(c);
+//Reserves address space for capacity customers and carves the columns
+//out of it. Nothing is backed by memory until a customer is first drawn
+//from a slot and written to.
+carena* new_carena(int capacity) {
+    carena* a;
+    size_t  at = 0;
+    if(capacity <= 0 || (a = (carena*)malloc(sizeof(carena))) == NULL)
+        return NULL;
+    a->capacity = (cid)capacity;
+    a->base     = NULL;
+    //A first pass sizes the reservation, a second points the columns into it
+    while(1) {
+        a->born    = (long*)_column(a, &at, sizeof(long));
+        a->died    = (long*)_column(a, &at, sizeof(long));
+        a->entered = (long*)_column(a, &at, sizeof(long));
+        a->job     = (double*)_column(a, &at, sizeof(double));
+        a->left    = (double*)_column(a, &at, sizeof(double));
+        a->next    = (cid*)_column(a, &at, sizeof(cid));
+        a->prio    = (unsigned char*)_column(a, &at, sizeof(unsigned char));
+        if(a->base != NULL)
+            break;
+        a->bytes = at;
+        a->base  = mmap(NULL, a->bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if(a->base == MAP_FAILED) {
+            free(a);
+            return NULL;
+        }
+        at = 0;
+    }
+    a->high  = 1;
+    a->free  = CID_NONE;
+    a->count = 0;
+    pthread_mutex_init(&a->lock, NULL);
+    return a;
+}
+
+//Recycled customers come first, their pages are the ones already warm
+cid carena_get(carena* a) {
+    cid c;
+    if(a == NULL)
+        return CID_NONE;
+    pthread_mutex_lock(&a->lock);
+    if(a->free != CID_NONE) {
+        c = a->free;
+        a->free = a->next[c];
+        a->count--;
+    } else if(a->high <= a->capacity) {
+        c = a->high++;
+    } else {
+        c = CID_NONE;
+    }
+    pthread_mutex_unlock(&a->lock);
+    return c;
+}
+
+void carena_put(carena* a, cid c) {
+    if(a == NULL || c == CID_NONE)
+        return;
+    pthread_mutex_lock(&a->lock);
+    a->next[c] = a->free;
+    a->free = c;
+    a->count++;
+    pthread_mutex_unlock(&a->lock);
+    return;
+}
+
+//Return a chain of customers linked by next in one go
+void carena_put_chain(carena* a, cid head, cid tail, int n) {
+    if(a == NULL || head == CID_NONE)
+        return;
+    pthread_mutex_lock(&a->lock);
+    a->next[tail] = a->free;
+    a->free = head;
+    a->count += n;
+    pthread_mutex_unlock(&a->lock);
+    return;
+}
+
+void destroy_carena(carena* a) {
+    if(a == NULL)
+        return;
+    //Customers live inside the reservation, anything still drawn goes with it
+    munmap(a->base, a->bytes);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
     return;
 }
 
 void print_cqueue_trace(cqueue q) {
-    customer* i = q.head;
-    if(q.head == NULL) {
+    carena* a = q.arena;
+    cid     i = q.head;
+    int     h;
+    if(cqueue_length(&q) == 0) {
         printf("Queue is empty\n");
         return;
     }
-    printf("Count : %d\n",q.count);
-    switch(q.mode) {
-        case SJF  : printf("Mode  : SJF\n");  break;
-        case FIFO : printf("Mode  : FIFO\n"); break;
-    }
-    printf("Address\t\t| Next\t\t| Previous\t| Job\n");
-    while(i != NULL) {
-        printf("%p\t|",i);
-        if(i->next == NULL)
-            printf(" %p\t\t|",i->next);
-        else
-            printf(" %p\t|",i->next);
-        if(i->prev == NULL)
-            printf(" %p\t\t|",i->prev);
-        else
-            printf(" %p\t|",i->prev);
-        printf(" %lf\n",i->job);
-        i = i->next;
+    printf("Count : %d\n",cqueue_length(&q));
+    printf("Mode  : %s\n",q.disc->title);
+    //Ring slots are not walked, other threads may be using them
+    if(q.mode == RING)
+        return;
+    //Heap slots are printed in array order
+    if(q.heap != NULL) {
+        printf("Slot\t| Customer\t| Sequence\t| Job\n");
+        for(h = 0; h < q.count; h++)
+            printf("%d\t| %u\t\t| %lu\t\t| %lf\n",h,q.heap[h].cust,q.heap[h].seq,q.heap[h].job);
+        return;
+    }
+    //Priority classes are printed one after the other
+    for(h = 0; q.lanes != NULL && h < CQ_CLASSES && (i = q.lanes[h].head) == CID_NONE; h++);
+    printf("Customer\t| Next\t\t| Job\n");
+    while(i != CID_NONE) {
+        printf("%u\t\t| %u\t\t| %lf\n",i,a->next[i],a->job[i]);
+        i = a->next[i];
+        while(i == CID_NONE && q.lanes != NULL && ++h < CQ_CLASSES)
+            i = q.lanes[h].head;
     }
     return;
 }
 
-void _encqueue_fifo(cqueue* q, customer* c) {
-    if(q == NULL || c == NULL)
+void _encqueue_fifo(cqueue* q, cid c) {
+    if(q == NULL || c == CID_NONE)
         return;
+    q->arena->next[c] = CID_NONE;
     //Queue is empty
-    if(q->head == NULL) {
+    if(q->head == CID_NONE) {
         q->head =  c;
         q->tail =  c;
         q->count = 1;
     } else {
-        q->tail->next = c;
-        c->prev = (customer*)q->tail;
+        q->arena->next[q->tail] = c;
         q->tail = c;
         q->count++;
     }
     return;
 }
 
-void _encqueue_sjf(cqueue* q, customer* c) {
-    if(q == NULL || c == NULL)
+void _encqueue_lifo(cqueue* q, cid c) {
+    if(q == NULL || c == CID_NONE)
+        return;
+    //Queue is empty
+    if(q->head == CID_NONE)
+        return _encqueue_fifo(q,c);
+    q->arena->next[c] = q->head;
+    q->head = c;
+    q->count++;
+    return;
+}
+
+void _encqueue_sjf(cqueue* q, cid c) {
+    cid*    next;
+    double* job;
+    cid     i, p;
+    if(q == NULL || c == CID_NONE)
         return;
+    next = q->arena->next;
+    job  = q->arena->job;
     //Queue is empty
-    if(q->head == NULL) {
+    if(q->head == CID_NONE) {
         return _encqueue_fifo(q,c);
-    //Node goes at head
-    } else if(c->job <= q->head->job) {
-        c->next = q->head;
-        q->head->prev = c;
+    //Node goes at head (equal jobs stay behind the current head)
+    } else if(job[c] < job[q->head]) {
+        next[c] = q->head;
         q->head = c;
         q->count++;
         return;
     //Node goes at the tail
-    } else if(c->job >= q->tail->job) {
+    } else if(job[c] >= job[q->tail]) {
         return _encqueue_fifo(q,c);
     //Node goes somewhere in between
     } else {
-        customer* i = q->head;
-        while(i != NULL) {
-            if(i->job >= c->job) {
-                //We add the new node after if jobs are equal
-                //i->next should never be null because of the
-                //third block of this if-else statement
-                if(i->job == c->job)
-                    i = i->next;
-                c->next = i;
-                i->prev->next = c;
-                c->prev = i->prev;
-                i->prev = c;
+        p = q->head;
+        i = next[p];
+        while(i != CID_NONE) {
+            //We add the new node after all nodes with equal jobs,
+            //i should never run out because of the third block of
+            //this if-else statement
+            if(job[i] > job[c]) {
+                next[c] = i;
+                next[p] = c;
                 q->count++;
                 break;
             }
-            i = i->next;
+            p = i;
+            i = next[i];
         }
     }
     return;
 }
+
+//No customer is in two places at once, the heap always has a slot free
+void _encqueue_heap(cqueue* q, cid c) {
+    cqentry e;
+    int i, p;
+    if(q == NULL || c == CID_NONE)
+        return;
+    e.job  = q->arena->left[c];
+    e.seq  = q->seq++;
+    e.cust = c;
+    //Sift up from the new leaf
+    i = q->count++;
+    while(i > 0) {
+        p = (i-1)/2;
+        if(q->heap[p].job < e.job || (q->heap[p].job == e.job && q->heap[p].seq < e.seq))
+            break;
+        q->heap[i] = q->heap[p];
+        i = p;
+    }
+    q->heap[i] = e;
+    return;
+}
+
+cid _decqueue_heap(cqueue* q) {
+    cid     c;
+    cqentry last;
+    int i, ch;
+    if(q->count == 0)
+        return CID_NONE;
+    c    = q->heap[0].cust;
+    last = q->heap[--q->count];
+    //Sift the last leaf down from the root
+    i = 0;
+    while((ch = 2*i+1) < q->count) {
+        if(ch+1 < q->count && (q->heap[ch+1].job < q->heap[ch].job ||
+           (q->heap[ch+1].job == q->heap[ch].job && q->heap[ch+1].seq < q->heap[ch].seq)))
+            ch++;
+        if(last.job < q->heap[ch].job || (last.job == q->heap[ch].job && last.seq < q->heap[ch].seq))
+            break;
+        q->heap[i] = q->heap[ch];
+        i = ch;
+    }
+    q->heap[i] = last;
+    return c;
+}
+
+cid _peek_list(cqueue* q) {
+    return q->head;
+}
+
+cid _peek_heap(cqueue* q) {
+    return (q->count > 0) ? q->heap[0].cust : CID_NONE;
+}
+
+//Every class is its own FIFO, the lowest class holding a customer is
+//found from the ready bits in one instruction
+void _encqueue_lane(cqueue* q, cid c) {
+    cqlane* l;
+    int k;
+    if(q == NULL || c == CID_NONE)
+        return;
+    k = (q->arena->prio[c] < CQ_CLASSES) ? q->arena->prio[c] : CQ_CLASSES-1;
+    l = &q->lanes[k];
+    q->arena->next[c] = CID_NONE;
+    if(l->tail == CID_NONE)
+        l->head = c;
+    else
+        q->arena->next[l->tail] = c;
+    l->tail = c;
+    q->ready |= 1u << k;
+    q->count++;
+    return;
+}
+
+cid _decqueue_lane(cqueue* q) {
+    cid     c;
+    cqlane* l;
+    int k;
+    if(q->ready == 0)
+        return CID_NONE;
+    k = __builtin_ctz(q->ready);
+    l = &q->lanes[k];
+    c = l->head;
+    l->head = q->arena->next[c];
+    if(l->head == CID_NONE) {
+        l->tail = CID_NONE;
+        q->ready &= ~(1u << k);
+    }
+    q->count--;
+    q->arena->next[c] = CID_NONE;
+    return c;
+}
+
+cid _peek_lane(cqueue* q) {
+    return q->ready ? q->lanes[__builtin_ctz(q->ready)].head : CID_NONE;
+}
+
+double _rank_left(const carena* a, cid c, double left) {
+    return left;
+}
+
+double _rank_prio(const carena* a, cid c, double left) {
+    return a->prio[c];
+}
+
+//A full ring drains as consumers catch up
+void _encqueue_wait(cqueue* q, cid c) {
+    while(!_encqueue_ring(q,c))
+        sched_yield();
+}
+
+//Bounded MPMC ring after Vyukov: every slot carries the ticket of the
+//operation allowed to touch it next, producers and consumers claim
+//tickets with a CAS and never block each other
+int _encqueue_ring(cqueue* q, cid c) {
+    cqring*       r = q->ring;
+    cqslot*       slot;
+    unsigned long pos, turn;
+    long          dif;
+    if(c == CID_NONE)
+        return 1;
+    pos = atomic_load_explicit(&r->enq, memory_order_relaxed);
+    while(1) {
+        slot = &r->slots[pos & r->mask];
+        turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+        dif  = (long)(turn - pos);
+        if(dif == 0) {
+            if(atomic_compare_exchange_weak_explicit(&r->enq, &pos, pos+1,
+               memory_order_relaxed, memory_order_relaxed))
+                break;
+        //Slot still holds a customer from one lap ago, ring is full
+        } else if(dif < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&r->enq, memory_order_relaxed);
+        }
+    }
+    q->arena->next[c] = CID_NONE;
+    slot->cust = c;
+    atomic_store_explicit(&slot->turn, pos+1, memory_order_release);
+    return 1;
+}
+
+cid _decqueue_ring(cqueue* q) {
+    cqring*       r = q->ring;
+    cqslot*       slot;
+    cid           c;
+    unsigned long pos, turn;
+    long          dif;
+    pos = atomic_load_explicit(&r->deq, memory_order_relaxed);
+    while(1) {
+        slot = &r->slots[pos & r->mask];
+        turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+        dif  = (long)(turn - (pos+1));
+        if(dif == 0) {
+            if(atomic_compare_exchange_weak_explicit(&r->deq, &pos, pos+1,
+               memory_order_relaxed, memory_order_relaxed))
+                break;
+        //Slot not yet filled for this lap, ring is empty
+        } else if(dif < 0) {
+            return CID_NONE;
+        } else {
+            pos = atomic_load_explicit(&r->deq, memory_order_relaxed);
+        }
+    }
+    c = slot->cust;
+    atomic_store_explicit(&slot->turn, pos+r->mask+1, memory_order_release);
+    return c;
+}
+
+//Stamp an operation that changed the length by change
+void _account(cqueue* q, int d) {
+    cqstats* s = q->stats;
+    double   t = s->clock(s->arg) - s->start;
+    long     o = atomic_fetch_add_explicit(&s->length, d, memory_order_relaxed);
+    long     n = o + d;
+    int      bo, bn;
+    _atomic_add(&s->m1, t*d);
+    _atomic_add(&s->m2, t*(double)(n*n - o*o));
+    bo = (o < CQ_LENGTHS-1) ? (int)o : CQ_LENGTHS-1;
+    bn = (n < CQ_LENGTHS-1) ? (int)n : CQ_LENGTHS-1;
+    if(bo != bn) {
+        _atomic_add(&s->hist[bn], t);
+        _atomic_add(&s->hist[bo], -t);
+    }
+}
+
+void _atomic_add(_Atomic double* a, double v) {
+    double o = atomic_load_explicit(a, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(a, &o, o+v, memory_order_relaxed, memory_order_relaxed));
+}
+
+//Columns are laid out one after the other from at, page aligned, and
+//pointed into the reservation once it exists
+void* _column(carena* a, size_t* at, size_t size) {
+    size_t start = *at;
+    *at += ((size_t)(a->capacity+1)*size + ARENA_PAGE-1)/ARENA_PAGE*ARENA_PAGE;
+    return (a->base != NULL) ? (char*)a->base + start : NULL;
+}
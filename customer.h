@@ -4,38 +4,154 @@
 #include <sys/time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
-//Different insert modes
-enum _cqmode {FIFO = 0, SJF = 1};
+//Different insert modes (SJFLIST is the sorted list SJF used before the heap,
+//RING is a lock-free bounded FIFO safe for many producers and consumers).
+//SRPT and PRIO let a waiting customer take a server from a running one,
+//RR hands service out in quanta.
+enum _cqmode {FIFO = 0, SJF = 1, SJFLIST = 2, RING = 3, LIFO = 4, SRPT = 5, RR = 6, PRIO = 7};
+
+//Number of queue modes
+#define CQ_MODES   8
+//Priority classes a PRIO queue keeps apart, later classes share the last
+#define CQ_CLASSES 32
+
+//Queue lengths the time weighted histogram tells apart, the last one
+//also collects every longer queue
+#define CQ_LENGTHS 64
 
 //Misc Typedefs
 typedef enum   _cqmode cqmode;
-typedef struct timeval timeval;
+typedef double (*cqclock)(void* arg); //Clock stamping queue operations (seconds)
+
+//Customers are slots of an arena, linked by index, slot 0 is never handed
+//out and stands for no customer at all
+typedef unsigned int cid;
+#define CID_NONE 0
+
+typedef void (*cqvisit)(cid customer, void* arg); //Visitor handed the customers of a queue one by one
+
+//Structure for a slot in the SJF and SRPT heap
+typedef struct _cqentry {
+    double            job;  //Customer's service still owed, kept here so sifting stays in the array
+    unsigned long     seq;  //Insertion order, equal jobs are served first come first served
+    cid               cust; //Customer occupying the slot
+} cqentry;
+
+//Structure for a slot in the lock-free ring
+typedef struct _cqslot {
+    atomic_ulong      turn; //Ticket of the operation allowed to use the slot next
+    cid               cust; //Customer occupying the slot
+} cqslot;
 
-//Structure for holding customer data
-typedef struct _customer {
-    struct _customer* next; //Next customer in queue
-    struct _customer* prev; //Previous customer in queue
-    struct timeval    born; //Time customer enters system
-    struct timeval    died; //Time customer leaves system
-    double            job;  //Customer's job time (microseconds)
-} customer;
+//Structure for the lock-free ring, tickets kept on separate cache lines
+typedef struct _cqring {
+    _Alignas(64) atomic_ulong enq;     //Next ticket handed to a producer
+    _Alignas(64) atomic_ulong deq;     //Next ticket handed to a consumer
+    _Alignas(64) unsigned long mask;   //Number of slots minus one (power of two)
+    struct _cqslot          slots[]; //Ring storage
+} cqring;
+
+//Structure for time weighted length accounting. Each sum holds t*change
+//in some function f of the length over every operation, so the integral
+//of f up to time T is T*f(L_T) minus the sum. Operations add to the sums
+//with atomics, readers never take a lock and are at most one operation
+//behind.
+typedef struct _cqstats {
+    cqclock           clock; //Clock operations are stamped with
+    void*               arg; //Argument handed to the clock
+    double            start; //Clock reading accounting started at
+    atomic_long      length; //Queue length as accounted so far
+    _Atomic double       m1; //Sum of t*change in L
+    _Atomic double       m2; //Sum of t*change in L^2
+    _Atomic double hist[CQ_LENGTHS]; //Sum of t*change in [L == k]
+} cqstats;
+
+//Structure for one priority class of a PRIO queue
+typedef struct _cqlane {
+    cid                head; //First customer of the class
+    cid                tail; //Last customer of the class
+} cqlane;
+
+struct _cqueue;
+struct _carena;
+
+//Structure for a scheduling discipline, every mode is one of these and
+//queues reach their storage through it. A waiting customer whose rank is
+//lower than that of a running one takes its server, the running one
+//going back in line with the service it is still owed.
+typedef struct _cqdisc {
+    const char*        name; //Name on the command line and in reports
+    const char*       title; //Name on the display
+    void             (*enq)(struct _cqueue* queue, cid customer);
+    cid              (*deq)(struct _cqueue* queue);
+    cid             (*peek)(struct _cqueue* queue); //Next customer out, left in place (NULL if unsupported)
+    double          (*rank)(const struct _carena* arena, cid customer, double left); //Preemption rank (NULL never preempts)
+    int              sliced; //Service is handed out in quanta, unfinished customers go back in line
+} cqdisc;
 
 //Structure for customer queue
 typedef struct _cqueue {
-    struct _customer*  head; //First customer of queue
-    struct _customer*  tail; //Last customer of queue
+    cid                head; //First customer of queue (list modes)
+    cid                tail; //Last customer of queue (list modes)
     int               count; //Number of customers enqueued
     enum   _cqmode     mode; //Insertion mode
+    const struct _cqdisc* disc; //Discipline of the mode
+    struct _cqentry*   heap; //Binary min-heap on (left, seq) (SJF and SRPT modes)
+    int                size; //Number of slots in heap, one per customer of the arena
+    unsigned long       seq; //Next insertion sequence number
+    struct _cqring*    ring; //Lock-free ring storage (RING mode)
+    struct _cqlane*   lanes; //FIFO of each priority class (PRIO mode)
+    unsigned int      ready; //Bit k set while lane k holds a customer (PRIO mode)
+    struct _cqstats*  stats; //Time weighted length accounting (NULL when off)
+    struct _carena*   arena; //Arena the customers and their links live in
 } cqueue;
 
-customer* decqueue(cqueue* queue);
-void      encqueue(cqueue* queue, customer* customer);
-cqueue*   new_cqueue(cqmode mode);
-customer* new_customer(double job, timeval born);
-customer* new_blank_customer(void);
+//Structure for every customer of a run, stored column by column in one
+//reservation of address space. Pages are only backed by memory once
+//written, so a run pays for the columns its engine touches, up to the
+//most customers it held at once.
+typedef struct _carena {
+    long*              born; //Time customer enters system (nanoseconds)
+    long*              died; //Time customer leaves system (nanoseconds, threaded runs)
+    long*           entered; //Time customer entered the network, born is per station (nanoseconds, networks)
+    double*             job; //Customer's job time (seconds)
+    double*            left; //Service still owed, below job once served in part (seconds)
+    cid*               next; //Next customer in queue, or on the free list
+    unsigned char*     prio; //Priority class, class 0 is served first (PRIO mode)
+    void*              base; //Reservation the columns are carved from
+    size_t            bytes; //Length of the reservation
+    cid            capacity; //Number of customers the arena can hold
+    cid                high; //First slot never handed out, everything below it was
+    cid                free; //Blank customers ready to be drawn (linked by next)
+    int               count; //Number of blank customers on the free list
+    pthread_mutex_t    lock; //Guards the free list, drawn and returned from different threads
+} carena;
+
+cid       decqueue(cqueue* queue);
+void      encqueue(cqueue* queue, cid customer);
+cid       cqueue_peek(cqueue* queue);
+cid       cqueue_detach(cqueue* queue);
+int       cqueue_splice(cqueue* queue, cqueue* from);
+cqueue*   new_cqueue(cqmode mode, carena* arena);
+const cqdisc* cqmode_disc(cqmode mode);
+int       cqmode_parse(const char* spec, cqmode* mode, double* arg);
+int       cqueue_length(cqueue* queue);
+int       cqueue_account(cqueue* queue, cqclock clock, void* arg);
+int       cqueue_account_save(cqueue* queue, cqstats* into);
+int       cqueue_account_from(cqueue* queue, cqclock clock, void* arg, const cqstats* from);
+int       cqueue_length_stats(cqueue* queue, double* mean, double* sigma, double* share);
+int       cqueue_length_area(cqueue* queue, double* at, double* area);
+double    cqstats_area(const cqstats* stats, double at);
+void      cqueue_walk(cqueue* queue, cqvisit visit, void* arg);
 void      destroy_cqueue(cqueue* queue);
-void      destroy_customer(customer* condemed);
 void      print_cqueue_trace(cqueue queue);
+carena*   new_carena(int capacity);
+cid       carena_get(carena* arena);
+void      carena_put(carena* arena, cid customer);
+void      carena_put_chain(carena* arena, cid head, cid tail, int count);
+void      destroy_carena(carena* arena);
 
 #endif // CUSTOMER_H_INCLUDED
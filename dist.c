@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dist.h"
+
+//Default shape parameters for specifications that leave them out
+#define ERLANG_K     2
+#define HYPER_CV     2.0
+#define LOGNORMAL_CV 1.0
+#define PARETO_ALPHA 2.5
+
+static double _norm_quantile(double u);
+static int    _lognormal(dist* d, double cv);
+static int    _empirical(dist* d, const char* path);
+
+//Specifications are a name with an optional parameter after a colon:
+//exp, det, erlang:k, hyper:cv, lognormal:cv, pareto:alpha and
+//empirical:file. Returns NULL on a bad specification or file.
+dist* new_dist(const char* spec) {
+    const char* arg;
+    char*  end;
+    double v = 0;
+    size_t len;
+    dist*  d;
+
+    if(spec == NULL || (d = (dist*)calloc(1, sizeof(dist))) == NULL)
+        return NULL;
+    if((d->spec = strdup(spec)) == NULL) {
+        free(d);
+        return NULL;
+    }
+    arg = strchr(spec, ':');
+    len = arg ? (size_t)(arg - spec) : strlen(spec);
+    if(arg && strncmp(spec, "empirical", len)) {
+        v = strtod(++arg, &end);
+        if(end == arg || *end != '\0' || !(v > 0)) {
+            destroy_dist(d);
+            return NULL;
+        }
+    }
+
+    if(len == 3 && !strncmp(spec, "exp", len) && !arg) {
+        d->kind = DIST_EXP;
+    } else if(len == 3 && !strncmp(spec, "det", len) && !arg) {
+        d->kind = DIST_DET;
+    } else if(len == 6 && !strncmp(spec, "erlang", len) && v == floor(v)) {
+        d->kind = DIST_ERLANG;
+        d->k    = arg ? (int)v : ERLANG_K;
+    } else if(len == 5 && !strncmp(spec, "hyper", len) && (!arg || v >= 1)) {
+        //Two balanced phases, each carrying half the mean, with the
+        //squared coefficient of variation asked for
+        v = arg ? v*v : HYPER_CV*HYPER_CV;
+        d->kind     = DIST_HYPER;
+        d->p        = (1 + sqrt((v-1)/(v+1)))/2;
+        d->phase[0] = 1/(2*d->p);
+        d->phase[1] = 1/(2*(1-d->p));
+    } else if(len == 9 && !strncmp(spec, "lognormal", len)) {
+        d->kind = DIST_LOGNORMAL;
+        if(_lognormal(d, arg ? v : LOGNORMAL_CV)) {
+            destroy_dist(d);
+            return NULL;
+        }
+    } else if(len == 6 && !strncmp(spec, "pareto", len) && (!arg || v > 1)) {
+        //The mean is infinite at or below alpha = 1
+        d->kind  = DIST_PARETO;
+        d->alpha = arg ? v : PARETO_ALPHA;
+        d->xm    = (d->alpha-1)/d->alpha;
+    } else if(len == 9 && !strncmp(spec, "empirical", len) && arg) {
+        d->kind = DIST_EMPIRICAL;
+        if(_empirical(d, arg+1)) {
+            destroy_dist(d);
+            return NULL;
+        }
+    } else {
+        destroy_dist(d);
+        return NULL;
+    }
+    return d;
+}
+
+void destroy_dist(dist* d) {
+    if(d == NULL)
+        return;
+    free(d->spec);
+    free(d->quant);
+    free(d->keep);
+    free(d->alias);
+    free(d->lower);
+    free(d->width);
+    free(d);
+    return;
+}
+
+//Exact lognormal quantile, only the top cell of the table lands here
+double dist_tail(const dist* d, double u) {
+    return exp(d->m + d->s*_norm_quantile(u));
+}
+
+//Acklam's rational approximation, polished with one Halley step against
+//erfc so the quantile is good to double precision
+double _norm_quantile(double u) {
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double e[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    double q, r, x, err;
+    if(u <= 0)
+        return -HUGE_VAL;
+    if(u >= 1)
+        return HUGE_VAL;
+    if(u < 0.02425) {
+        q = sqrt(-2*log(u));
+        x = (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5])/((((e[0]*q+e[1])*q+e[2])*q+e[3])*q+1);
+    } else if(u > 1-0.02425) {
+        q = sqrt(-2*log(1-u));
+        x = -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5])/((((e[0]*q+e[1])*q+e[2])*q+e[3])*q+1);
+    } else {
+        q = u-0.5;
+        r = q*q;
+        x = (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q/
+            (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
+    }
+    err = 0.5*erfc(-x/M_SQRT2) - u;
+    r   = err*sqrt(2*M_PI)*exp(x*x/2);
+    return x - r/(1 + x*r/2);
+}
+
+//Tabulates the quantiles of a unit mean lognormal. Interpolating between
+//them shifts the mean a little, so the table is rescaled until the cells
+//plus the exact tail average to one again.
+int _lognormal(dist* d, double cv) {
+    double inner = 0, tail;
+    int i;
+    d->s     = sqrt(log(1 + cv*cv));
+    d->m     = -d->s*d->s/2;
+    d->cells = DIST_CELLS;
+    if((d->quant = (double*)malloc(d->cells*sizeof(double))) == NULL)
+        return -1;
+    d->quant[0] = 0;
+    for(i = 1; i < d->cells; i++)
+        d->quant[i] = dist_tail(d, (double)i/d->cells);
+    for(i = 0; i+1 < d->cells; i++)
+        inner += (d->quant[i] + d->quant[i+1])/2/d->cells;
+    //Share of the mean above the last quantile
+    tail = 0.5*erfc(-(d->s - _norm_quantile((d->cells-1.0)/d->cells))/M_SQRT2);
+    for(i = 0; i < d->cells; i++)
+        d->quant[i] *= (1 - tail)/inner;
+    return 0;
+}
+
+//Reads a histogram, one bin per line as its upper edge and its weight.
+//Bins start where the previous one ends, the first at zero, and values
+//spread evenly across a bin. Lines starting with '#' are comments. The
+//shape is kept and scaled to unit mean, bins are picked by an alias table.
+int _empirical(dist* d, const char* path) {
+    FILE*  in;
+    char   line[256];
+    double upper, weight, edge = 0, total = 0, mean = 0;
+    int*   small;
+    int*   large;
+    int    n = 0, size = 0, ns = 0, nl = 0, i, j;
+    void*  grown;
+
+    if((in = fopen(path, "r")) == NULL)
+        return -1;
+    while(fgets(line, sizeof(line), in)) {
+        if(line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if(sscanf(line, "%lf %lf", &upper, &weight) != 2 || upper <= edge || weight < 0) {
+            fclose(in);
+            return -1;
+        }
+        if(n == size) {
+            size = size ? 2*size : 64;
+            if((grown = realloc(d->lower, size*sizeof(double))) == NULL) {
+                fclose(in);
+                return -1;
+            }
+            d->lower = (double*)grown;
+            if((grown = realloc(d->width, size*sizeof(double))) == NULL) {
+                fclose(in);
+                return -1;
+            }
+            d->width = (double*)grown;
+            if((grown = realloc(d->keep, size*sizeof(double))) == NULL) {
+                fclose(in);
+                return -1;
+            }
+            d->keep = (double*)grown;
+        }
+        d->lower[n] = edge;
+        d->width[n] = upper - edge;
+        d->keep[n]  = weight;
+        total += weight;
+        mean  += weight*(edge + upper)/2;
+        edge   = upper;
+        n++;
+    }
+    fclose(in);
+    if(n == 0 || total <= 0)
+        return -1;
+    mean /= total;
+    for(i = 0; i < n; i++) {
+        d->lower[i] /= mean;
+        d->width[i] /= mean;
+        d->keep[i]   = d->keep[i]*n/total;
+    }
+
+    //Vose's alias method: bins short of the average share are topped up
+    //by one bin over it, each cell ends up holding at most two bins
+    d->cells = n;
+    d->alias = (int*)malloc(n*sizeof(int));
+    small    = (int*)malloc(n*sizeof(int));
+    large    = (int*)malloc(n*sizeof(int));
+    if(d->alias == NULL || small == NULL || large == NULL) {
+        free(small);
+        free(large);
+        return -1;
+    }
+    for(i = 0; i < n; i++) {
+        d->alias[i] = i;
+        if(d->keep[i] < 1)
+            small[ns++] = i;
+        else
+            large[nl++] = i;
+    }
+    while(ns > 0 && nl > 0) {
+        i = small[--ns];
+        j = large[nl-1];
+        d->alias[i] = j;
+        d->keep[j] -= 1 - d->keep[i];
+        if(d->keep[j] < 1) {
+            nl--;
+            small[ns++] = j;
+        }
+    }
+    //Whatever is left over is full up to rounding
+    while(nl > 0)
+        d->keep[large[--nl]] = 1;
+    while(ns > 0)
+        d->keep[small[--ns]] = 1;
+    free(small);
+    free(large);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef DIST_H_INCLUDED
+#define DIST_H_INCLUDED
+
+#include "rng.h"
+
+//Cells of the lognormal inverse CDF table
+#define DIST_CELLS 1024
+
+//Shapes interarrival and service times can take
+enum _distkind {DIST_EXP = 0, DIST_DET = 1, DIST_ERLANG = 2, DIST_HYPER = 3,
+                DIST_LOGNORMAL = 4, DIST_PARETO = 5, DIST_EMPIRICAL = 6};
+
+//Misc Typedefs
+typedef enum   _distkind distkind;
+
+//Structure for a distribution with unit mean, callers divide by the rate
+//just like they do with unit exponentials. Shapes that are hard to invert
+//are tabulated when built so a draw is a couple of loads and a multiply.
+//Built once and only read afterwards, so every thread can share one.
+typedef struct _dist {
+    enum _distkind   kind;            //Shape of the distribution
+    char*            spec;            //Specification it was built from
+    int              k;               //Phases summed (Erlang)
+    double           p;               //Chance of the first phase (hyperexponential)
+    double           phase[2];        //Mean of each phase (hyperexponential)
+    double           xm;              //Smallest value (Pareto)
+    double           alpha;           //Tail index (Pareto)
+    double           m, s;            //Mean and sigma of the log (lognormal)
+    int              cells;           //Cells of the tables below
+    double*          quant;           //Inverse CDF at i/cells (lognormal)
+    double*          keep;            //Chance of keeping the bin drawn (empirical alias table)
+    int*             alias;           //Bin taken otherwise (empirical alias table)
+    double*          lower;           //Lower edge of each bin (empirical)
+    double*          width;           //Width of each bin (empirical)
+} dist;
+
+dist*   new_dist(const char* spec);
+void    destroy_dist(dist* d);
+double  dist_tail(const dist* d, double u);
+
+//Next variate with unit mean, NULL draws unit exponentials
+static inline double dist_next(const dist* d, expblock* b) {
+    double t, x;
+    int    i;
+    if(d == NULL)
+        return expblock_next(b);
+    switch(d->kind) {
+        case DIST_EXP:
+            return expblock_next(b);
+        case DIST_DET:
+            return 1.0;
+        case DIST_ERLANG:
+            for(x = 0, i = 0; i < d->k; i++)
+                x += expblock_next(b);
+            return x/d->k;
+        case DIST_HYPER:
+            return d->phase[rng_uniform(b->gen) >= d->p]*expblock_next(b);
+        case DIST_LOGNORMAL:
+            //Linear between tabulated quantiles, the last cell is the tail
+            t = rng_uniform(b->gen)*d->cells;
+            i = (int)t;
+            if(i >= d->cells-1)
+                return dist_tail(d, t/d->cells);
+            return d->quant[i] + (t-i)*(d->quant[i+1] - d->quant[i]);
+        case DIST_PARETO:
+            //(1-u)^(-1/alpha) is exp(E/alpha) for a unit exponential E
+            return d->xm*exp(expblock_next(b)/d->alpha);
+        case DIST_EMPIRICAL:
+            //The alias table picks the bin, the value is uniform within it
+            t = rng_uniform(b->gen)*d->cells;
+            i = (int)t;
+            i = (t-i < d->keep[i]) ? i : d->alias[i];
+            return d->lower[i] + d->width[i]*rng_uniform(b->gen);
+    }
+    return expblock_next(b);
+}
+
+#endif // DIST_H_INCLUDED
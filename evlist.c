@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include "evlist.h"
+
+static void _sift(evlist* list, int i, event* e);
+
+//Departures are one per server at most, so every server numbers below
+//the list's size
+int evlist_init(evlist* l, int size) {
+    int i;
+    l->heap  = (event*)malloc(size*sizeof(event));
+    l->slot  = (int*)malloc(size*sizeof(int));
+    l->count = 0;
+    l->size  = size;
+    l->seq   = 0;
+    if(l->heap == NULL || l->slot == NULL)
+        return -1;
+    for(i = 0; i < size; i++)
+        l->slot[i] = -1;
+    return 0;
+}
+
+void evlist_push(evlist* l, double time, evtype type, int server) {
+    event e;
+    e.time   = time;
+    e.seq    = l->seq++;
+    e.type   = type;
+    e.server = server;
+    _sift(l, l->count++, &e);
+    return;
+}
+
+int evlist_peek(evlist* l, event* e) {
+    if(l->count == 0)
+        return 0;
+    *e = l->heap[0];
+    return 1;
+}
+
+int evlist_pop(evlist* l, event* e) {
+    if(l->count == 0)
+        return 0;
+    *e = l->heap[0];
+    if(e->type == DEPARTURE)
+        l->slot[e->server] = -1;
+    if(--l->count > 0)
+        _sift(l, 0, &l->heap[l->count]);
+    return 1;
+}
+
+void evlist_free(evlist* l) {
+    free(l->heap);
+    free(l->slot);
+    l->heap  = NULL;
+    l->slot  = NULL;
+    l->count = 0;
+    l->size  = 0;
+    return;
+}
+
+//Drop the pending departure of a server, straight from where the heap
+//keeps it. A list emptied by resetting its count leaves stale slots
+//behind, those are told apart by what they point at.
+int evlist_cancel(evlist* l, int server) {
+    int i = l->slot[server];
+    if(i < 0 || i >= l->count || l->heap[i].type != DEPARTURE || l->heap[i].server != server)
+        return 0;
+    l->slot[server] = -1;
+    if(i < --l->count)
+        _sift(l, i, &l->heap[l->count]);
+    return 1;
+}
+
+//Settle an event into the hole at i, moving up or down from there. Every
+//departure moved has its slot follow it.
+void _sift(evlist* l, int i, event* e) {
+    int p, ch;
+    event last = *e;
+    event* h = l->heap;
+    while(i > 0 && (last.time < h[p = (i-1)/2].time || (last.time == h[p].time && last.seq < h[p].seq))) {
+        h[i] = h[p];
+        if(h[i].type == DEPARTURE)
+            l->slot[h[i].server] = i;
+        i = p;
+    }
+    while((ch = 2*i+1) < l->count) {
+        if(ch+1 < l->count && (h[ch+1].time < h[ch].time ||
+           (h[ch+1].time == h[ch].time && h[ch+1].seq < h[ch].seq)))
+            ch++;
+        if(last.time < h[ch].time || (last.time == h[ch].time && last.seq < h[ch].seq))
+            break;
+        h[i] = h[ch];
+        if(h[i].type == DEPARTURE)
+            l->slot[h[i].server] = i;
+        i = ch;
+    }
+    h[i] = last;
+    if(last.type == DEPARTURE)
+        l->slot[last.server] = i;
+    return;
+}
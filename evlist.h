@@ -0,0 +1,34 @@
+#ifndef EVLIST_H_INCLUDED
+#define EVLIST_H_INCLUDED
+
+//Future event types
+enum _evtype {ARRIVAL = 0, DEPARTURE = 1};
+
+//Misc Typedefs
+typedef enum   _evtype evtype;
+
+//Structure for a scheduled event
+typedef struct _event {
+    double            time;   //Time the event fires (simulated or wall seconds)
+    unsigned long     seq;    //Scheduling order, breaks ties in time
+    enum   _evtype    type;   //Kind of event
+    int               server; //Server the event belongs to (departures)
+} event;
+
+//Structure for the future event list (binary min-heap on time)
+typedef struct _evlist {
+    struct _event*    heap;   //Heap ordered events
+    int*              slot;   //Position of each server's departure in the heap (-1 when none)
+    int               count;  //Number of events scheduled
+    int               size;   //Number of events the heap can hold
+    unsigned long     seq;    //Next scheduling sequence number
+} evlist;
+
+int  evlist_init(evlist* list, int size);
+void evlist_push(evlist* list, double time, evtype type, int server);
+int  evlist_peek(evlist* list, event* e);
+int  evlist_pop(evlist* list, event* e);
+int  evlist_cancel(evlist* list, int server);
+void evlist_free(evlist* list);
+
+#endif // EVLIST_H_INCLUDED
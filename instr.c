@@ -0,0 +1,222 @@
+#include "instr.h"
+
+#ifdef INSTRUMENT
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//Most threads that can register a buffer
+#define INSTR_THREADS 1024
+
+static const char* counter_names[] = {"handoffs", "takeoffs", "signals", "idle_polls", "cond_waits", "sleeps",
+                                      "flushes", "drains"};
+static const char* kind_names[]    = {"idle", "sleep", "analyze", "snapshot"};
+
+static pthread_mutex_t  registry = PTHREAD_MUTEX_INITIALIZER;
+static instrbuf*        buffers[INSTR_THREADS];
+static int              nbuffers = 0;
+static pthread_mutex_t* locks[INSTR_LOCKS-1];
+static const char*      lock_names[INSTR_LOCKS] = {NULL, NULL, NULL, "other"};
+static __thread instrbuf* self = NULL;
+
+static int  _lock_index(pthread_mutex_t* m);
+static int  _bucket(long ns);
+static long _bucket_top(int b);
+static long _percentile(long* hist, double q);
+static void _push(instrbuf* b, int what, long start, long dur);
+
+//Names are given before any thread starts, lookups need no lock
+void instr_lock_name(pthread_mutex_t* m, const char* name) {
+    int i;
+    for(i = 0; i < INSTR_LOCKS-1; i++) {
+        if(locks[i] == NULL || locks[i] == m) {
+            locks[i]      = m;
+            lock_names[i] = name;
+            return;
+        }
+    }
+}
+
+void instr_thread(const char* name, int id) {
+    instrbuf* b = (instrbuf*)calloc(1, sizeof(instrbuf));
+    if(b == NULL)
+        return;
+    if(id >= 0)
+        snprintf(b->name, sizeof(b->name), "%s %d", name, id);
+    else
+        snprintf(b->name, sizeof(b->name), "%s", name);
+    pthread_mutex_lock(&registry);
+    if(nbuffers < INSTR_THREADS) {
+        buffers[nbuffers++] = b;
+        self = b;
+    } else {
+        free(b);
+    }
+    pthread_mutex_unlock(&registry);
+}
+
+//An uncontended lock costs one trylock, only waits read the clock
+void instr_lock(pthread_mutex_t* m) {
+    instrbuf* b = self;
+    long start, dur;
+    int  l;
+    if(pthread_mutex_trylock(m) == 0) {
+        if(b) {
+            l = _lock_index(m);
+            b->acquires[l]++;
+            b->waits[l][0]++;
+        }
+        return;
+    }
+    start = instr_now();
+    pthread_mutex_lock(m);
+    if(b == NULL)
+        return;
+    dur = instr_now() - start;
+    l   = _lock_index(m);
+    b->acquires[l]++;
+    b->contended[l]++;
+    b->waits[l][_bucket(dur)]++;
+    _push(b, l, start, dur);
+}
+
+long instr_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000L + t.tv_nsec;
+}
+
+void instr_span(int what, long start) {
+    if(self)
+        _push(self, what, start, instr_now() - start);
+}
+
+void instr_count(int c) {
+    if(self)
+        self->counts[c]++;
+}
+
+//Chrome trace event format, loads in chrome://tracing and Perfetto
+int instr_dump(const char* path) {
+    FILE* f = fopen(path, "w");
+    instrbuf* b;
+    instrspan* s;
+    long first = -1, last = 0;
+    int  i, j, k, sep = 0;
+    if(f == NULL)
+        return -1;
+    for(i = 0; i < nbuffers; i++) {
+        for(j = 0; j < buffers[i]->nspans; j++) {
+            s = &buffers[i]->spans[j];
+            if(first < 0 || s->start < first) first = s->start;
+            if(s->start + s->dur > last)      last  = s->start + s->dur;
+        }
+    }
+    if(first < 0)
+        first = last = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for(i = 0; i < nbuffers; i++) {
+        b = buffers[i];
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                sep++ ? ",\n" : "", i+1, b->name);
+        for(j = 0; j < b->nspans; j++) {
+            s = &b->spans[j];
+            if(s->what < INSTR_LOCKS)
+                fprintf(f, ",\n{\"name\":\"wait %s\",\"cat\":\"lock\"", lock_names[s->what]);
+            else
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"thread\"", kind_names[s->what - INSTR_LOCKS]);
+            fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf}",
+                    i+1, (s->start - first)/1000.0, s->dur/1000.0);
+        }
+        //Final counter values close each thread's track
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3lf,\"args\":{",
+                b->name, i+1, (last - first)/1000.0);
+        for(k = 0; k < IC_COUNTERS; k++)
+            fprintf(f, "%s\"%s\":%ld", k ? "," : "", counter_names[k], b->counts[k]);
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) ? -1 : 0;
+}
+
+void instr_summary(FILE* out) {
+    instrbuf* b;
+    int i, k, l;
+    for(i = 0; i < nbuffers; i++) {
+        b = buffers[i];
+        fprintf(out, "# instr thread=\"%s\"", b->name);
+        for(k = 0; k < IC_COUNTERS; k++)
+            fprintf(out, " %s=%ld", counter_names[k], b->counts[k]);
+        fprintf(out, " dropped_spans=%ld\n", b->dropped);
+        for(l = 0; l < INSTR_LOCKS; l++) {
+            if(b->acquires[l] == 0)
+                continue;
+            fprintf(out, "# instr thread=\"%s\" lock=%s acquires=%ld contended=%ld"
+                         " wait_ns_p50=%ld wait_ns_p99=%ld wait_ns_max=%ld\n",
+                    b->name, lock_names[l], b->acquires[l], b->contended[l],
+                    _percentile(b->waits[l], 0.5), _percentile(b->waits[l], 0.99),
+                    _percentile(b->waits[l], 1.0));
+        }
+    }
+    fflush(out);
+}
+
+void instr_free(void) {
+    int i;
+    pthread_mutex_lock(&registry);
+    for(i = 0; i < nbuffers; i++)
+        free(buffers[i]);
+    nbuffers = 0;
+    pthread_mutex_unlock(&registry);
+}
+
+int _lock_index(pthread_mutex_t* m) {
+    int i;
+    for(i = 0; i < INSTR_LOCKS-1; i++)
+        if(locks[i] == m)
+            return i;
+    return INSTR_LOCKS-1;
+}
+
+//Bucket b > 0 holds waits below 2^b nanoseconds
+int _bucket(long ns) {
+    int b = 1;
+    while(b < INSTR_BUCKETS-1 && (1L << b) <= ns)
+        b++;
+    return b;
+}
+
+long _bucket_top(int b) {
+    return b ? (1L << b) : 0;
+}
+
+//Upper edge of the bucket holding the q-th wait
+long _percentile(long* hist, double q) {
+    long total = 0, seen = 0, rank;
+    int  b;
+    for(b = 0; b < INSTR_BUCKETS; b++)
+        total += hist[b];
+    rank = (long)(q*total + 0.5);
+    if(rank < 1) rank = 1;
+    for(b = 0; b < INSTR_BUCKETS-1; b++) {
+        seen += hist[b];
+        if(seen >= rank)
+            break;
+    }
+    return _bucket_top(b);
+}
+
+void _push(instrbuf* b, int what, long start, long dur) {
+    instrspan* s;
+    if(b->nspans == INSTR_SPANS) {
+        b->dropped++;
+        return;
+    }
+    s = &b->spans[b->nspans++];
+    s->start = start;
+    s->dur   = dur;
+    s->what  = what;
+}
+
+#endif // INSTRUMENT
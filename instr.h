@@ -0,0 +1,80 @@
+#ifndef INSTR_H_INCLUDED
+#define INSTR_H_INCLUDED
+
+#include <stdio.h>
+#include <pthread.h>
+
+//Hot path instrumentation of the threaded engine. Everything below is
+//only built with -DINSTRUMENT (make instrumented), otherwise the macros
+//expand to nothing but the plain lock call and cost nothing.
+
+//Counters kept per thread
+enum _instrcount {IC_HANDOFFS = 0, IC_TAKEOFFS, IC_SIGNALS, IC_IDLE_POLLS, IC_COND_WAITS, IC_SLEEPS,
+                  IC_FLUSHES, IC_DRAINS, IC_COUNTERS};
+//Timeline spans other than lock waits
+enum _instrkind {IK_IDLE = 0, IK_SLEEP, IK_ANALYZE, IK_SNAPSHOT, IK_KINDS};
+
+//Locks told apart, the last slot collects any lock never named
+#define INSTR_LOCKS   4
+//Log2 nanosecond buckets of the lock wait histograms
+#define INSTR_BUCKETS 40
+//Timeline spans each thread keeps, later ones are only counted
+#define INSTR_SPANS   (1 << 18)
+
+#ifdef INSTRUMENT
+
+#define INSTR_ENABLED 1
+
+//Structure for one span of a thread's timeline
+typedef struct _instrspan {
+    long             start;           //Monotonic nanoseconds the span began
+    long             dur;             //Nanoseconds it lasted
+    int              what;            //Lock index, or INSTR_LOCKS plus an instrkind
+} instrspan;
+
+//Structure for the buffer a thread records into, only its own thread
+//writes it so nothing on the hot path is shared
+typedef struct _instrbuf {
+    char             name[32];        //Thread name on the timeline
+    long             counts[IC_COUNTERS];                  //Per thread counters
+    long             acquires[INSTR_LOCKS];                //Lock acquisitions
+    long             contended[INSTR_LOCKS];               //Acquisitions that had to wait
+    long             waits[INSTR_LOCKS][INSTR_BUCKETS];    //Lock wait histograms (bucket 0 is no wait)
+    long             dropped;         //Spans past the end of the buffer
+    int              nspans;          //Spans recorded
+    struct _instrspan spans[INSTR_SPANS]; //Timeline
+} instrbuf;
+
+void  instr_lock_name(pthread_mutex_t* m, const char* name);
+void  instr_thread(const char* name, int id);
+void  instr_lock(pthread_mutex_t* m);
+long  instr_now(void);
+void  instr_span(int what, long start);
+void  instr_count(int counter);
+int   instr_dump(const char* path);
+void  instr_summary(FILE* out);
+void  instr_free(void);
+
+#define INSTR_LOCK_NAME(m, name) instr_lock_name(m, name)
+#define INSTR_THREAD(name, id)   instr_thread(name, id)
+#define INSTR_LOCK(m)            instr_lock(m)
+#define INSTR_COUNT(counter)     instr_count(counter)
+#define INSTR_MARK(t)            long t = instr_now()
+#define INSTR_SPAN(kind, t)      instr_span(INSTR_LOCKS + (kind), t)
+#define INSTR_REPORT(path)       do { if(path) instr_dump(path); instr_summary(stderr); instr_free(); } while(0)
+
+#else
+
+#define INSTR_ENABLED 0
+
+#define INSTR_LOCK_NAME(m, name)
+#define INSTR_THREAD(name, id)
+#define INSTR_LOCK(m)            pthread_mutex_lock(m)
+#define INSTR_COUNT(counter)
+#define INSTR_MARK(t)
+#define INSTR_SPAN(kind, t)
+#define INSTR_REPORT(path)
+
+#endif // INSTRUMENT
+
+#endif // INSTR_H_INCLUDED
@@ -1,33 +1,76 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
-#include <semaphore.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
 #include <pthread.h>
 #include <math.h>
 #include <ncurses.h>
 #include "customer.h"
 #include "simout.h"
+#include "vsim.h"
+#include "report.h"
+#include "replicate.h"
+#include "rng.h"
+#include "evlist.h"
+#include "trace.h"
+#include "sweep.h"
+#include "instr.h"
+#include "steady.h"
+#include "net.h"
+#include "snap.h"
 
 #define DEBUG
 
 //Default settings and macros
-#define SERVER_MAX        5
+#define SERVER_MAX        100000
 #define DEFAULT_LAMBDA    3.0
 #define DEFAULT_MU        4.0
 #define DEFAULT_CUSTOMERS 1000
+#define ADAPT_CUSTOMERS   10000000
 #define DEFAULT_SERVERS   1
 #define DEFAULT_QMODE     FIFO
 #define DEFAULT_SEED      0
+#define IDLE_INTERVAL     0.25
+#define DISPLAY_INTERVAL  0.02
+#define FLUSH_BATCH       64
+#define FLUSH_INTERVAL    0.005
+
+//Per server statistics, written by the owning worker and read by the
+//statistics thread for the display
+typedef struct _srvstat {
+    _Atomic double   worked;          //Seconds of service started by this server
+    atomic_int       served;          //Customers this server has finished
+} srvstat;
 
 //Thread input structures
 typedef struct _genesis_data {
-    double           lambda;          //Arrival time exponential distribution parameter
-    double           mu;              //Service time exponential distribution parameter
+    double           lambda;          //Arrival rate, one over the mean interarrival time
+    double           mu;              //Service rate, one over the mean job
+    const dist*      arrivals;        //Shape of interarrival times (NULL draws exponentials)
+    const dist*      service;         //Shape of jobs (NULL draws exponentials)
+    const profile*   profile;         //Time varying arrival rate (NULL keeps lambda constant)
+    long             epoch;           //Start of the run the profile is laid out from
     double           rseed;           //Seed for random numbers
+    int              customers;       //Total number of customers being generated
+    int              classes;         //Priority classes customers are spread over
+    tracemap*        replay;          //Reference to trace arrivals are replayed from (NULL draws them)
+    tracewriter*     record;          //Reference to trace arrivals are written to (NULL when off)
     cqueue*          live;            //Reference to queue for live (unserviced) customers
-    cqueue*          source;          //Reference to queue containing blank customers
+    carena*          arena;           //Reference to arena handing out blank customers
     pthread_mutex_t* livelock;        //Reference to mutex to lock live queue
-    sem_t*           customers_left;  //Reference to semaphore of customers left to generate
+    pthread_cond_t*  livecond;        //Reference to condition signaled when live queue gains a customer
+    atomic_int*      livesleep;       //Reference to count of servers asleep on livecond
+    int*             generating;      //Reference to flag cleared when genesis is done (under livelock)
+    atomic_int*      stop;            //Reference to flag set once the precision is reached
+    tally*           slack;           //Reference to lateness of arrivals past their deadline
+    snapcut*         cut;             //Reference to snapshot cuts genesis stops for (NULL when off)
+    int              resumed;         //Generator state comes from a snapshot instead of the seed
+    snapgen          gen;             //State of the generator, copied out by snapshots
 } genesis_data;
 
 typedef struct _statistics_data {
@@ -35,38 +78,95 @@ typedef struct _statistics_data {
     int              servers;         //Total number of servers for simulation
     cqueue*          live;            //Reference to queue for live (unserviced) customers
     cqueue*          dead;            //Reference to queue for dead (serviced) customers
+    carena*          arena;           //Reference to arena analyzed customers are returned to
     pthread_mutex_t* deadlock;        //Reference to mutex to lock dead queue
     pthread_mutex_t* livelock;        //Reference to mutex to lock live queue
     pthread_mutex_t* displock;        //Reference to mutext to lock display for updating
-    sem_t*           customers_left;  //Reference to semaphore of customers left to generate
-    sem_t*           servers_left;    //Reference to semaphore of servers left working
+    pthread_cond_t*  deadcond;        //Reference to condition signaled when dead queue gains a customer
+    atomic_int*      deadsleep;       //Reference to count of threads asleep on deadcond
+    int*             serving;         //Reference to count of workers still serving (under deadlock)
+    srvstat*         stats;           //Reference to the statistics of every server
+    int              headless;        //Skip the display entirely
+    steady*          steady;          //Steady state wait estimate (NULL unless adaptive)
+    atomic_int*      stop;            //Reference to flag telling genesis the precision is reached
+    const profile*   profile;         //Arrival rate profile windows are kept over (NULL when constant)
+    long             epoch;           //Start of the run the profile is laid out from
+    simresult*       result;          //Reference to results the final statistics are stored in
+    snapcut*         cut;             //Reference to snapshot cuts of genesis and the workers (NULL when off)
+    snapshot*        snap;            //Snapshot every cut is copied into
+    const char*      snapfile;        //File snapshots are written to
+    double           snapevery;       //Seconds between snapshots
+    int              snapfails;       //Snapshots that could not be taken or written
+    int              whole;           //Next snapshot rewrites the file instead of appending to it
+    pid_t            writer;          //Process writing the last snapshot (0 when none)
+    struct _genesis_data* gensd;      //Reference to genesis data, for snapshots
+    struct _service_data* servd;      //Reference to every worker's data, for snapshots
+    int              workers;         //Number of workers
+    const snapshot*  resume;          //Snapshot the run resumed from (NULL when fresh)
+    cid              backlog;         //Customers a resumed run found served, linked by next
 } statistics_data;
 
 typedef struct _service_data {
-    int              stid;            //Service thread number
+    int              stid;            //Service thread (worker) number
+    int              first;           //First server this worker runs
+    int              count;           //Number of servers this worker runs
+    double           quantum;         //Longest stretch of service before going back in line (0 runs to the end)
+    srvstat*         stats;           //Reference to the statistics of every server
+    carena*          arena;           //Reference to arena the customers being served live in
     cqueue*          live;            //Reference to queue for live (unserviced) customers
     cqueue*          dead;            //Reference to queue for dead (serviced) customers
     pthread_mutex_t* deadlock;        //Reference to mutex to lock dead queue
     pthread_mutex_t* livelock;        //Reference to mutex to lock live queue
-    pthread_mutex_t* displock;        //Reference to mutex to lock display for updating
-    sem_t*           customers_left;  //Reference to semaphore of customers left to generate
-    sem_t*           servers_left;    //Reference to semaphore of servers left working
+    pthread_cond_t*  livecond;        //Reference to condition signaled when live queue gains a customer
+    pthread_cond_t*  deadcond;        //Reference to condition signaled when dead queue gains a customer
+    atomic_int*      livesleep;       //Reference to count of servers asleep on livecond
+    atomic_int*      deadsleep;       //Reference to count of threads asleep on deadcond
+    int*             generating;      //Reference to flag cleared when genesis is done (under livelock)
+    int*             serving;         //Reference to count of workers still serving (under deadlock)
+    tally*           slack;           //Lateness of this worker's completions past their deadline
+    snapcut*         cut;             //Reference to snapshot cuts the worker stops for (NULL when off)
+    cid*             current;         //Customer each server is working on (NULL unless running)
+    double*          slice;           //Service the running slice of each server covers
+    double*          ends;            //Time the running slice of each server ends, in seconds since started
+    long             started;         //Time the worker started
+    cqueue*          finished;        //Customers done but not yet flushed to the dead queue
 } service_data;
 
-//Prototypes and inline functions
-static inline double rexp(double l) {return -log(1.0-drand48())/l;}
+//Prototypes
 void*   genesis(void*);
 void*   service(void*);
 void*   statistics(void*);
-void    psleep(double interval);
-double  time_elapsed(timeval finish, timeval start);
+long    monotonic_ns(void);
+long    nanoseconds(double seconds);
+double  elapsed(long finish, long start);
+long    sleep_until(long due);
+void    deadline(struct timespec* t, long due);
+void    handoff(cqueue* q, cid c, pthread_mutex_t* lock, pthread_cond_t* cond, atomic_int* sleepers);
+cid     takeoff(cqueue* q, pthread_mutex_t* lock, pthread_cond_t* cond, atomic_int* sleepers,
+                int* open, struct timespec* until, int* more, snapcut* cut);
+void    flush(cqueue* q, cqueue* batch, pthread_mutex_t* lock, pthread_cond_t* cond, atomic_int* sleepers);
+cid     drain(cqueue* q, pthread_mutex_t* lock);
+cid     contend(service_data* servd, simbusy* busy, cid* current, double* slice, double* ends,
+                long started, struct timespec* until, int* victim);
+void    retire(service_data* servd, srvstat* stats, cqueue* finished, cid c, double served,
+               long at, int server);
+void    server_stats(srvstat* stats, int servers, double elapsed, simresult* result);
+int     restore(snapshot* snap, cqueue* live, long epoch, cid* backlog);
+void    checkpoint(statistics_data* statd, long analyzed, double worked, double sampled, double area);
+int     settle(statistics_data* statd, int block);
+void    integrate(statistics_data* statd, double* sampled, double* area, double at, double to);
+double  wall_clock(void* epoch);
+int     virtual_main(simconfig* config, int headless);
+void    close_traces(simconfig* config);
+int     replicate_main(simconfig* config, int reps);
+int     sweep_main(simconfig* config, char** spec);
+int     network_main(simconfig* config, const char* path);
 
 int main(int argc, char** argv)
 {
     ////////////////////////////////////////////////////////////////////////
     //Queue variables
-    customer*        c;      //Used for allocating memory for customers
-    cqueue*          source; //Customer factory
+    carena*          arena;  //Customer factory
     cqueue*          live;   //Stores unservice customers
     cqueue*          dead;   //Stores serviced customers not yet analyzed
     ////////////////////////////////////////////////////////////////////////
@@ -74,29 +174,65 @@ int main(int argc, char** argv)
     genesis_data     gensd;
     statistics_data  statd;
     service_data*    servd;
+    srvstat*         stats;
+    simconfig        config;
+    simresult*       result;
     ////////////////////////////////////////////////////////////////////////
     //Thread related variables
     pthread_mutex_t  deadlock;
     pthread_mutex_t  livelock;
     pthread_mutex_t  displock;
 
-    sem_t            customers_left;
-    sem_t            servers_left;
+    pthread_cond_t   livecond;
+    pthread_cond_t   deadcond;
+    atomic_int       livesleep;
+    atomic_int       deadsleep;
+    atomic_int       stopping;
+    int              generating;
+    int              serving;
 
     pthread_t*       service_t;
     pthread_t        genesis_t;
     pthread_t        statistics_t;
+    pthread_condattr_t clockattr;
+    long             epoch;
+    snapcut          cut;
+    snapshot*        restored = NULL; //Snapshot of -resume
+    cid              backlog  = CID_NONE;
 
     pthread_attr_t   attributes;
-    int              terror, i;
+    int              terror, i, workers;
     ////////////////////////////////////////////////////////////////////////
     //Simulation related variables
     cqmode mode      = DEFAULT_QMODE;
+    double modearg   = 0;
     int    servers   = DEFAULT_SERVERS;
     double rseed     = DEFAULT_SEED;
     int    customers = DEFAULT_CUSTOMERS;
     double lambda    = DEFAULT_LAMBDA;
     double mu        = DEFAULT_MU;
+    double precision = 0;
+    int    vtime     = 0;
+    int    lockfree  = 0;
+    int    headless  = 0;
+    int    reps      = 0;
+    int    repeated  = 0;
+    int    limited   = 0;
+    char*  replay    = NULL;
+    char*  record    = NULL;
+    int    grid      = 0;
+    char*  dump      = NULL;
+    char*  shape[2]  = {NULL, NULL}; //Distributions of -a and -j
+    char*  pace      = NULL;         //Arrival rate profile of -l
+    char*  netfile   = NULL;         //Network of -K
+    char*  snapfile  = NULL;         //Snapshot file of -C
+    double snapevery = SNAP_INTERVAL;
+    char*  resume    = NULL;         //Snapshot of -resume
+    char*  colon;
+    char*  end;
+    double delta, job;               //Means of a replayed trace
+    profile* rates   = NULL;
+    char*  spec[4]   = {NULL, NULL, NULL, NULL}; //Sweep axes of -L, -M, -N and -S
 
     ////////////////////////////////////////////////////////////////////////
     // Parse command line parameters
@@ -107,21 +243,24 @@ int main(int argc, char** argv)
                     printf("Incomplete argument 'N'\n");
                     exit(-1);
                 }
-                servers = atoi(argv[++i]);
+                spec[2] = argv[++i];
+                servers = atoi(spec[2]);
                 break;
             case 'L':
                 if(i+1 >= argc) {
                     printf("Incomplete argument 'L'\n");
                     exit(-1);
                 }
-                lambda = (double)atof(argv[++i]);
+                spec[0] = argv[++i];
+                lambda  = (double)atof(spec[0]);
                 break;
             case 'M':
                 if(i+1 >= argc) {
                     printf("Incomplete argument 'M'\n");
                     exit(-1);
                 }
-                mu = (double)atof(argv[++i]);
+                spec[1] = argv[++i];
+                mu      = (double)atof(spec[1]);
                 break;
             case 'T':
                 if(i+1 >= argc) {
@@ -129,6 +268,46 @@ int main(int argc, char** argv)
                     exit(-1);
                 }
                 customers = atoi(argv[++i]);
+                limited   = 1;
+                break;
+            case 'A':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'A'\n");
+                    exit(-1);
+                }
+                precision = (double)atof(argv[++i]);
+                if(precision <= 0 || precision >= 1) {
+                    printf("The precision is a relative half width between 0 and 1\n");
+                    exit(-1);
+                }
+                break;
+            case 'a':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'a'\n");
+                    exit(-1);
+                }
+                shape[0] = argv[++i];
+                break;
+            case 'K':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'K'\n");
+                    exit(-1);
+                }
+                netfile = argv[++i];
+                break;
+            case 'l':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'l'\n");
+                    exit(-1);
+                }
+                pace = argv[++i];
+                break;
+            case 'j':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'j'\n");
+                    exit(-1);
+                }
+                shape[1] = argv[++i];
                 break;
             case 'R':
                 if(i+1 >= argc) {
@@ -142,10 +321,68 @@ int main(int argc, char** argv)
                     printf("Incomplete argument 'S'\n");
                     exit(-1);
                 }
-                if(atoi(argv[++i]))
-                    mode = SJF;
-                else
-                    mode = FIFO;
+                spec[3] = argv[++i];
+                break;
+            case 'G':
+                grid  = 1;
+                vtime = 1;
+                break;
+            case 'D':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'D'\n");
+                    exit(-1);
+                }
+                dump = argv[++i];
+                break;
+            case 'V':
+                vtime = 1;
+                break;
+            case 'F':
+                lockfree = 1;
+                break;
+            case 'B':
+                headless = 1;
+                break;
+            case 'P':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'P'\n");
+                    exit(-1);
+                }
+                reps     = atoi(argv[++i]);
+                repeated = 1;
+                vtime    = 1;
+                break;
+            case 'W':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'W'\n");
+                    exit(-1);
+                }
+                record = argv[++i];
+                break;
+            case 'I':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'I'\n");
+                    exit(-1);
+                }
+                replay = argv[++i];
+                break;
+            case 'C':
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'C'\n");
+                    exit(-1);
+                }
+                snapfile = argv[++i];
+                break;
+            case 'r':
+                if(strcmp(argv[i], "-resume")) {
+                    printf("Invalid argument '%s'\n",argv[i]);
+                    exit(-1);
+                }
+                if(i+1 >= argc) {
+                    printf("Incomplete argument 'resume'\n");
+                    exit(-1);
+                }
+                resume = argv[++i];
                 break;
             default:
                 printf("Invalid argument '%s'\n",argv[i]);
@@ -155,92 +392,366 @@ int main(int argc, char** argv)
     }
 
     ////////////////////////////////////////////////////////////////////////
-    //Enforce restrictions
-    if(servers > SERVER_MAX || servers <= 0) {
+    //Snapshots are taken every SNAP_INTERVAL unless -C names file:seconds
+    if(snapfile && (colon = strrchr(snapfile, ':')) != NULL) {
+        snapevery = strtod(colon+1, &end);
+        if(end == colon+1 || *end != '\0' || !(snapevery > 0)) {
+            printf("Invalid snapshot interval '%s' (-C file[:seconds])\n",colon+1);
+            exit(-1);
+        }
+        *colon = '\0';
+    }
+    //A resumed run takes every parameter from its snapshot
+    if(resume) {
+        for(i = 1; i < argc; i++) {
+            if(!strcmp(argv[i], "-resume") || !strcmp(argv[i], "-C") || !strcmp(argv[i], "-D")) {
+                i++;
+            } else if(strcmp(argv[i], "-B")) {
+                printf("A resumed run takes its parameters from the snapshot, -resume can only be\n"
+                       "combined with -B, -C and -D\n");
+                exit(-1);
+            }
+        }
+        if((restored = snapshot_read(resume)) == NULL) {
+            printf("Error: can't read snapshot '%s'\n",resume);
+            exit(-1);
+        }
+        lambda    = restored->lambda;
+        mu        = restored->mu;
+        rseed     = restored->rseed;
+        precision = restored->precision;
+        customers = restored->customers;
+        servers   = restored->servers;
+        lockfree  = (restored->mode == RING);
+        mode      = lockfree ? FIFO : (cqmode)restored->mode;
+        modearg   = (mode == RR) ? restored->quantum : (mode == PRIO) ? restored->classes : 0;
+        shape[0]  = restored->spec[0];
+        shape[1]  = restored->spec[1];
+        pace      = restored->spec[2];
+        replay    = restored->spec[3];
+        limited   = 1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //A profile stands in for -L, lambda becomes its mean rate over the cycle
+    if(pace && (rates = new_profile(pace)) == NULL) {
+        printf("Invalid arrival rate profile '%s' (sin:mean:amplitude:period or a file of 'duration rate' lines)\n",pace);
+        exit(-1);
+    }
+    if(rates)
+        lambda = rates->mean;
+
+    ////////////////////////////////////////////////////////////////////////
+    //Enforce restrictions, a sweep checks its own list of disciplines
+    if(spec[3] && !grid && cqmode_parse(spec[3], &mode, &modearg)) {
+        printf("Invalid discipline '%s' (fifo, sjf, sjf_list, lifo, srpt, rr[:quantum], prio[:classes])\n",spec[3]);
+        exit(-1);
+    } else if(dump && !INSTR_ENABLED) {
+        printf("Timeline dumps need the instrumented build (make instrumented)\n");
+        exit(-1);
+    } else if(dump && vtime) {
+        printf("Only threaded runs are instrumented\n");
+        exit(-1);
+    } else if((snapfile || resume) && (vtime || netfile || record)) {
+        printf("Snapshots are only taken of threaded runs, -C and -resume can't be combined\n"
+               "with -V, -P, -G, -K or -W\n");
+        exit(-1);
+    } else if(grid && (reps || replay || record || lockfree)) {
+        printf("Sweeps run in virtual time and can't be combined with -P, -I, -W or -F\n");
+        exit(-1);
+    } else if(!grid && (servers > SERVER_MAX || servers <= 0)) {
         printf("The number of servers is restricted between 1 and %d\n",SERVER_MAX);
         exit(-1);
-    } else if(mu*servers < lambda) {
+    } else if(lockfree && mode != FIFO) {
+        printf("The lock-free queue only supports FIFO mode\n");
+        exit(-1);
+    } else if(lockfree && vtime) {
+        printf("The lock-free queue is only used by threaded runs\n");
+        exit(-1);
+    } else if(repeated && reps < 2) {
+        printf("Replications need at least two runs for a confidence interval (-P 2 or more)\n");
+        exit(-1);
+    } else if(netfile && (spec[0] || spec[1] || spec[2] || spec[3] || grid || reps || replay ||
+                          record || lockfree || rates || precision > 0)) {
+        printf("A network sets its own stations and runs in virtual time, -K can't be combined\n"
+               "with -L, -M, -N, -S, -G, -P, -I, -W, -F, -l or -A\n");
+        exit(-1);
+    } else if(rates && (spec[0] || grid || replay)) {
+        printf("A profile sets the arrival rate, -l can't be combined with -L, -G or -I\n");
+        exit(-1);
+    } else if(replay && (shape[0] || shape[1])) {
+        printf("A replayed trace sets interarrival times and jobs, -a and -j can't reshape them\n");
+        exit(-1);
+    } else if(reps > 0 && (replay || record)) {
+        printf("Replications draw their own workloads and can't record or replay a trace\n");
+        exit(-1);
+    } else if(!grid && !replay && mu*servers < lambda) {
         printf("The product of mu and the number of servers must be greater than lambda\n");
         exit(-1);
     }
     if(rseed == 0) rseed = time(NULL);
+    //Adaptive runs go until the precision is reached, -T caps them
+    if(precision > 0 && !limited)
+        customers = ADAPT_CUSTOMERS;
+    config.lambda    = lambda;
+    config.mu        = mu;
+    config.rseed     = rseed;
+    config.customers = customers;
+    config.precision = precision;
+    config.servers   = servers;
+    config.stream    = 0;
+    config.replay    = NULL;
+    config.record    = NULL;
+    config.arrivals  = NULL;
+    config.service   = NULL;
+    config.profile   = rates;
+    simconfig_mode(&config, lockfree ? RING : mode, modearg);
+    //Distributions keep the means at 1/lambda and 1/mu
+    if(shape[0])
+        config.arrivals = new_dist(shape[0]);
+    if(shape[1])
+        config.service  = new_dist(shape[1]);
+    for(i = 0; i < 2; i++) {
+        if(shape[i] && (i ? config.service : config.arrivals) == NULL) {
+            printf("Invalid distribution '%s' (exp, det, erlang[:k], hyper[:cv], lognormal[:cv], pareto[:alpha], empirical:file)\n",shape[i]);
+            exit(-1);
+        }
+    }
 
     ////////////////////////////////////////////////////////////////////////
-    //Setup queues and allocate all memory we will need before we start
-    live   = new_cqueue(mode);
-    dead   = new_cqueue(FIFO);
-    source = new_cqueue(FIFO);
-    if(!live || !dead || !source) {
-        printf("Error: queue memmory allocation failed\n");
-        exit(-1);
-    }
-    //Make all the customers and enqueue them into source
-    for(i = 0; i < customers; i++) {
-        c = new_blank_customer();
-        if(c == NULL) {
-            printf("Error: queue memmory allocation failed\n");
+    //A replayed trace sets the number of customers unless -T asks for fewer
+    if(replay) {
+        if((config.replay = trace_open(replay)) == NULL) {
+            printf("Error: can't map trace '%s'\n",replay);
             exit(-1);
         }
-        encqueue(source,c);
+        if(!limited || (unsigned long)customers > config.replay->count)
+            customers = config.customers = (int)config.replay->count;
+        //The rates are the trace's own over the records replayed, whatever
+        //-L and -M said. A trace always runs out, so it needs no stability
+        //check.
+        if(trace_means(config.replay, customers, &delta, &job) == 0 && delta > 0 && job > 0) {
+            lambda = config.lambda = 1/delta;
+            mu     = config.mu     = 1/job;
+            simconfig_mode(&config, lockfree ? RING : mode, modearg);
+        }
+    }
+    if(record && (config.record = trace_create(record, TRACE_VARINT)) == NULL) {
+        printf("Error: can't create trace '%s'\n",record);
+        exit(-1);
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //Virtual time runs on an event list and needs none of the threads below
+    if(netfile)
+        i = network_main(&config, netfile);
+    else if(grid)
+        i = sweep_main(&config, spec);
+    else if(reps > 0)
+        i = replicate_main(&config, reps);
+    else if(vtime)
+        i = virtual_main(&config, headless);
+    if(netfile || grid || reps > 0 || vtime) {
+        destroy_dist(config.arrivals);
+        destroy_dist(config.service);
+        destroy_profile(config.profile);
+        return i;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //Setup queues and the customer arena, customers are drawn from the
+    //arena as they arrive and handed back once analyzed so memory only
+    //grows with the number of customers in the system
+    arena  = new_carena((customers > 0) ? customers : 1);
+    live   = arena ? new_cqueue(config.mode, arena) : NULL;
+    dead   = arena ? new_cqueue(lockfree ? RING : FIFO, arena) : NULL;
+    result = new_simresult(servers);
+    stats  = (srvstat*)calloc(servers, sizeof(srvstat));
+    //The live queue integrates its own length over wall time, a resumed
+    //run carrying on from the run time of its snapshot with the customers
+    //it held back in place
+    epoch = monotonic_ns();
+    if(restored) {
+        epoch -= restored->clock;
+        if(live && (restore(restored, live, epoch, &backlog) ||
+                    cqueue_account_from(live, wall_clock, &epoch, &restored->length)))
+            live = NULL;
+    } else if(live && cqueue_account(live, wall_clock, &epoch)) {
+        live = NULL;
+    }
+    if(!live || !dead || !result || !stats) {
+        printf("Error: queue memmory allocation failed\n");
+        exit(-1);
     }
 
     /////////////////////////////////////////////////////////////////////////
     //Multithreading
-    //Setup service thread and service thread data
-    service_t = (pthread_t*)malloc(servers*sizeof(pthread_t));
-    servd     = (service_data*)malloc(servers*sizeof(service_data));
+    //Servers are spread over a pool of worker threads, each one keeping
+    //its own servers busy, so thousands of servers don't need thousands
+    //of threads
+    workers   = (servers < online_cores()) ? servers : online_cores();
+    service_t = (pthread_t*)malloc(workers*sizeof(pthread_t));
+    servd     = (service_data*)malloc(workers*sizeof(service_data));
     if(!service_t || !servd) {
         printf("Error: service thread memory allocation failed\n");
         exit(-1);
     }
 
-    //Initialize semaphores
-    sem_init(&customers_left, 0, customers);
-    sem_init(&servers_left, 0, servers);
-    //Initialize mutexes
+    //Initialize shutdown state
+    generating = 1;
+    serving    = workers;
+    atomic_init(&livesleep, 0);
+    atomic_init(&deadsleep, 0);
+    atomic_init(&stopping, restored ? restored->stop : 0);
+    //Snapshots cut genesis and every worker
+    atomic_init(&cut.cutting, 0);
+    atomic_init(&cut.stopped, 0);
+    cut.threads = 1 + workers;
+    //Initialize mutexes and conditions
     pthread_mutex_init(&deadlock,NULL);
     pthread_mutex_init(&livelock,NULL);
     pthread_mutex_init(&displock,NULL);
+    //Timed waits share the monotonic timebase of every other deadline
+    pthread_condattr_init(&clockattr);
+    pthread_condattr_setclock(&clockattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&livecond,&clockattr);
+    pthread_cond_init(&deadcond,&clockattr);
+    pthread_condattr_destroy(&clockattr);
+    INSTR_LOCK_NAME(&livelock, "livelock");
+    INSTR_LOCK_NAME(&deadlock, "deadlock");
+    INSTR_LOCK_NAME(&displock, "displock");
     //Initialize thread attirbutes
     pthread_attr_init(&attributes);
     pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_JOINABLE);
 
     //Initialize genesis data
-    gensd.customers_left = &customers_left;
+    gensd.customers      = customers;
+    gensd.classes        = config.classes;
+    gensd.replay         = config.replay;
+    gensd.record         = config.record;
+    gensd.generating     = &generating;
+    gensd.livecond       = &livecond;
+    gensd.livesleep      = &livesleep;
     gensd.lambda         = lambda;
     gensd.rseed          = rseed;
     gensd.mu             = mu;
+    gensd.arrivals       = config.arrivals;
+    gensd.service        = config.service;
+    gensd.profile        = config.profile;
+    gensd.epoch          = epoch;
     gensd.live           = live;
-    gensd.source         = source;
+    gensd.arena          = arena;
+    gensd.stop           = &stopping;
     gensd.livelock       = &livelock;
+    gensd.slack          = result->arrive_slack;
+    gensd.cut            = snapfile ? &cut : NULL;
+    gensd.resumed        = (restored != NULL);
+    if(restored) {
+        gensd.gen            = restored->gen;
+        gensd.gen.due       += epoch;
+        gensd.gen.draws.gen  = &gensd.gen.random;
+        if(config.replay) {
+            trace_cursor(config.replay, &gensd.gen.cursor);
+            gensd.gen.cursor.pos = (const unsigned char*)config.replay->base + restored->cursor;
+            if(gensd.gen.cursor.pos > gensd.gen.cursor.end) {
+                printf("Error: trace '%s' is shorter than the snapshot has it\n",replay);
+                exit(-1);
+            }
+        }
+    }
     //Initialize statistics data
-    statd.customers_left = &customers_left;
-    statd.servers_left   = &servers_left;
+    statd.serving        = &serving;
+    statd.deadcond       = &deadcond;
+    statd.deadsleep      = &deadsleep;
     statd.servers        = servers;
     statd.customers      = customers;
     statd.live           = live;
     statd.dead           = dead;
+    statd.arena          = arena;
     statd.livelock       = &livelock;
     statd.deadlock       = &deadlock;
     statd.displock       = &displock;
+    statd.headless       = headless;
+    statd.result         = result;
+    statd.stats          = stats;
+    statd.stop           = &stopping;
+    statd.steady         = NULL;
+    statd.profile        = config.profile;
+    statd.epoch          = epoch;
+    statd.cut            = snapfile ? &cut : NULL;
+    statd.snap           = NULL;
+    statd.snapfile       = snapfile;
+    statd.snapevery      = snapevery;
+    statd.snapfails      = 0;
+    statd.whole          = 1;
+    statd.writer         = 0;
+    statd.gensd          = &gensd;
+    statd.servd          = servd;
+    statd.workers        = workers;
+    statd.resume         = restored;
+    statd.backlog        = backlog;
+    if(precision > 0) {
+        if((statd.steady = new_steady()) == NULL) {
+            printf("Error: steady state memory allocation failed\n");
+            exit(-1);
+        }
+        steady_init(statd.steady, precision);
+    }
+    if(snapfile && (statd.snap = new_snapshot(&config, replay)) == NULL) {
+        printf("Error: snapshot memory allocation failed\n");
+        exit(-1);
+    }
+    //A resumed run's statistics pick up where the snapshot left them
+    if(restored) {
+        for(i = 0; i < servers; i++) {
+            atomic_init(&stats[i].worked, restored->worked[i]);
+            atomic_init(&stats[i].served, restored->finished[i]);
+        }
+        *result->wait    = *restored->wait;
+        *result->sojourn = *restored->sojourn;
+        memcpy(result->windows, restored->windows, sizeof(restored->windows));
+        if(statd.steady)
+            steady_copy(statd.steady, restored->steady);
+    }
     //Initialize service data
-    for(i = 0; i < servers; i++) {
-        servd[i].customers_left = &customers_left;
-        servd[i].servers_left   = &servers_left;
+    for(i = 0; i < workers; i++) {
+        servd[i].generating     = &generating;
+        servd[i].serving        = &serving;
+        servd[i].livecond       = &livecond;
+        servd[i].deadcond       = &deadcond;
+        servd[i].livesleep      = &livesleep;
+        servd[i].deadsleep      = &deadsleep;
         servd[i].stid           = i;
+        servd[i].first          = i*servers/workers;
+        servd[i].count          = (i+1)*servers/workers - servd[i].first;
+        servd[i].quantum        = config.quantum;
+        servd[i].stats          = stats;
+        servd[i].arena          = arena;
         servd[i].live           = live;
         servd[i].dead           = dead;
         servd[i].deadlock       = &deadlock;
         servd[i].livelock       = &livelock;
-        servd[i].displock       = &displock;
+        servd[i].slack          = new_tally();
+        servd[i].cut            = snapfile ? &cut : NULL;
+        servd[i].current        = NULL;
+        servd[i].finished       = NULL;
+        if(!servd[i].slack) {
+            printf("Error: service thread memory allocation failed\n");
+            exit(-1);
+        }
     }
 
     //Initialize Display Screen
-    switch(mode) {
-        case FIFO: screen_init("FIFO"); break;
-        case SJF : screen_init("SJF");  break;
+    if(!headless) {
+        screen_init((char*)live->disc->title);
     }
 
+#ifdef PR_SET_TIMERSLACK
+    //Threads inherit the timer slack, the default 50us would show up in
+    //every deadline
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+#endif
+
     //Start gensis thread
     if((terror = pthread_create(&genesis_t,&attributes,(void*)genesis,(void*)&gensd))) {
         screen_end();
@@ -248,7 +759,7 @@ int main(int argc, char** argv)
         exit(-1);
     }
     //Start server threads
-    for(i = 0; i < servers; i++) {
+    for(i = 0; i < workers; i++) {
         if((terror = pthread_create(&service_t[i],&attributes,(void*)service,(void*)(&servd[i])))) {
             screen_end();
             printf("Error creating server thread #%d (Code:%d)\n",i,terror);
@@ -270,12 +781,14 @@ int main(int argc, char** argv)
         exit(-1);
     }
     //Wait for servers to finish
-    for(i = 0; i < servers; i++) {
+    for(i = 0; i < workers; i++) {
         if((terror = pthread_join(service_t[i], NULL))) {
             screen_end();
             printf("Error joing service thread #%d (Code:%d)\n",i,terror);
             exit(-1);
         }
+        tally_merge(result->finish_slack, servd[i].slack);
+        destroy_tally(servd[i].slack);
     }
     //Wait for statistics thread
     if((terror = pthread_join(statistics_t, NULL))) {
@@ -283,248 +796,948 @@ int main(int argc, char** argv)
         printf("Error joing statistics thread (Code:%d)\n",terror);
         exit(-1);
     }
+    INSTR_REPORT(dump);
 
-    wait_for_user();
+    //Batch runs leave one record behind instead of waiting on a key, the
+    //report names a replayed trace so it is closed after
+    if(headless)
+        print_report(stdout, "threaded", &config, result);
+    close_traces(&config);
+    if(!headless)
+        wait_for_user();
 
     /////////////////////////////////////////////////////////////////////////
-    //Clean up dynamically allocated memory, mutexes, and semaphores
+    //Clean up dynamically allocated memory, mutexes, and conditions
     screen_end();
+    if(statd.snapfails)
+        printf("Warning: %d snapshots could not be taken or written to '%s'\n",statd.snapfails,snapfile);
     pthread_mutex_destroy(&displock);
     pthread_mutex_destroy(&livelock);
     pthread_mutex_destroy(&deadlock);
-    sem_destroy(&customers_left);
-    sem_destroy(&servers_left);
-    destroy_cqueue(source);
+    pthread_cond_destroy(&livecond);
+    pthread_cond_destroy(&deadcond);
+    //Queues are drained by now, the arena owns every customer
     destroy_cqueue(live);
     destroy_cqueue(dead);
+    destroy_carena(arena);
+    destroy_simresult(result);
+    destroy_steady(statd.steady);
+    destroy_snapshot(statd.snap);
+    destroy_snapshot(restored);
+    destroy_dist(config.arrivals);
+    destroy_dist(config.service);
+    destroy_profile(config.profile);
+    free(stats);
     free(service_t);
     free(servd);
     return 0;
 }
 
-void psleep(double interval) {
+int virtual_main(simconfig* cfg, int headless) {
+    simresult* res = new_simresult(cfg->servers);
+    double utilized = 0;
+    char   title[64];
+    int i;
+
+    if(res == NULL || vsim_run(cfg, res)) {
+        printf("Error: virtual time simulation failed\n");
+        exit(-1);
+    }
+    if(headless) {
+        print_report(stdout, "virtual", cfg, res);
+        close_traces(cfg);
+        destroy_simresult(res);
+        return 0;
+    }
+    close_traces(cfg);
+
+    //Display the same screen the threaded simulation ends on
+    snprintf(title, sizeof(title), "%s, virtual time", cqmode_disc(cfg->mode)->title);
+    screen_init(title);
+    for(i = 0; i < cfg->servers; i++)
+        utilized += res->utilized[i];
+    update_servers(cfg->servers, res->utilized, res->served);
+    update_progress(res->elapsed, utilized, res->analyzed, cfg->customers, cfg->servers);
+    update_queue_stats(res->qlen_avg, res->qlen_sigma);
+    update_wait_stats(res->wait_avg, res->wait_sigma);
+    wait_for_user();
+    screen_end();
+
+    destroy_simresult(res);
+    return 0;
+}
+
+void close_traces(simconfig* cfg) {
+    trace_unmap(cfg->replay);
+    cfg->replay = NULL;
+    if(trace_close(cfg->record)) {
+        screen_end();
+        printf("Error: trace write failed\n");
+        exit(-1);
+    }
+    cfg->record = NULL;
+}
+
+int replicate_main(simconfig* cfg, int reps) {
+    simresult** res = (simresult**)calloc(reps, sizeof(simresult*));
+    int i;
+
+    if(res == NULL) {
+        printf("Error: replication memory allocation failed\n");
+        exit(-1);
+    }
+    for(i = 0; i < reps; i++) {
+        if((res[i] = new_simresult(cfg->servers)) == NULL) {
+            printf("Error: replication memory allocation failed\n");
+            exit(-1);
+        }
+    }
+    if(replicate(cfg, res, reps, online_cores())) {
+        printf("Error: virtual time replication failed\n");
+        exit(-1);
+    }
+
+    //Replications are summarized as one record, there is no screen for them
+    print_replications(stdout, cfg, res, reps);
+    for(i = 0; i < reps; i++)
+        destroy_simresult(res[i]);
+    free(res);
+    return 0;
+}
+
+int network_main(simconfig* cfg, const char* path) {
+    network*   net = new_network(path);
+    netresult* res;
+    int i;
+
+    if(net == NULL) {
+        printf("Error: can't read network '%s' (station servers mu discipline lambda, route from to probability)\n",path);
+        exit(-1);
+    } else if(net->servers > SERVER_MAX) {
+        printf("The number of servers over all stations is restricted to %d\n",SERVER_MAX);
+        exit(-1);
+    } else if((i = network_overloaded(net)) >= 0) {
+        printf("Station %d can't keep up with the %.9g customers a second routed to it\n",i+1,net->st[i].rate);
+        exit(-1);
+    }
+    if((res = new_netresult(net->count)) == NULL || net_run(net, cfg, res)) {
+        printf("Error: network simulation failed\n");
+        exit(-1);
+    }
+
+    //There is no screen for a network, the record is the output
+    print_network(stdout, cfg, net, res);
+    destroy_netresult(res);
+    destroy_network(net);
+    return 0;
+}
+
+int sweep_main(simconfig* cfg, char** spec) {
+    const char* names = "LMNS";
+    double      base[3] = {cfg->lambda, cfg->mu, cfg->servers};
+    char        one[32];
+    sweepaxis   axes[4];
+    sweeprow*   rows;
+    int i, j, count;
+
+    //Parameters without a grid keep their single value
+    for(i = 0; i < 4; i++) {
+        if(i < 3)
+            snprintf(one, sizeof(one), "%.17g", base[i]);
+        if(i < 3 ? sweep_axis(spec[i] ? spec[i] : one, &axes[i])
+                 : sweep_modes(spec[i] ? spec[i] : "fifo", &axes[i])) {
+            printf("Invalid sweep values for '%c'\n",names[i]);
+            exit(-1);
+        }
+        for(j = 0; j < axes[i].count; j++) {
+            if(i < 2 && axes[i].values[j] <= 0) {
+                printf("Sweep values for '%c' must be positive\n",names[i]);
+                exit(-1);
+            } else if(i == 2 && (axes[i].values[j] != floor(axes[i].values[j]) ||
+                      axes[i].values[j] < 1 || axes[i].values[j] > SERVER_MAX)) {
+                printf("The number of servers is restricted between 1 and %d\n",SERVER_MAX);
+                exit(-1);
+            }
+        }
+    }
+    if((rows = sweep_grid(cfg, &axes[0], &axes[1], &axes[2], &axes[3], &count)) == NULL) {
+        printf("Error: sweep grid memory allocation failed\n");
+        exit(-1);
+    }
+    if(sweep(rows, count, online_cores())) {
+        printf("Error: sweep failed\n");
+        exit(-1);
+    }
+
+    //The whole sweep is one table, unstable points are flagged in it
+    print_sweep(stdout, rows, count);
+    for(i = 0; i < 4; i++)
+        free_sweep_axis(&axes[i]);
+    free(rows);
+    return 0;
+}
+
+long monotonic_ns(void) {
     struct timespec t;
-    t.tv_sec  = (int)floor(interval);
-    t.tv_nsec = (interval-t.tv_sec) * 1000000000L;
-    nanosleep(&t,NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000L + t.tv_nsec;
 }
 
-double time_elapsed(timeval f, timeval s) {
-    double  sec = (f.tv_sec-s.tv_sec);
-    double usec = (f.tv_usec-s.tv_usec)/1000000;
-    return (double)(sec+usec);
+long nanoseconds(double s) {
+    return (long)llround(s*1e9);
+}
+
+double elapsed(long f, long s) {
+    return (f-s)/1e9;
+}
+
+long sleep_until(long due) {
+    struct timespec t;
+    deadline(&t, due);
+    INSTR_MARK(slept);
+    //Signals cut the sleep short, the deadline stays put
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+    INSTR_SPAN(IK_SLEEP, slept);
+    INSTR_COUNT(IC_SLEEPS);
+    return monotonic_ns() - due;
+}
+
+void deadline(struct timespec* t, long due) {
+    t->tv_sec  = due/1000000000L;
+    t->tv_nsec = due%1000000000L;
+}
+
+void handoff(cqueue* q, cid c, pthread_mutex_t* m, pthread_cond_t* cv, atomic_int* sleepers) {
+    INSTR_COUNT(IC_HANDOFFS);
+    if(q->mode == RING) {
+        encqueue(q, c);
+        //Only go near the mutex when someone may be asleep on it, the
+        //fence keeps the ring store ahead of reading the sleeper count
+        atomic_thread_fence(memory_order_seq_cst);
+        if(atomic_load(sleepers) == 0)
+            return;
+        INSTR_LOCK(m);
+        pthread_cond_signal(cv);
+        pthread_mutex_unlock(m);
+        INSTR_COUNT(IC_SIGNALS);
+        return;
+    }
+    INSTR_LOCK(m);
+    encqueue(q, c);
+    //Under a preemptive discipline a busy worker may be the one to act,
+    //every sleeper gets a look
+    if(q->disc->rank)
+        pthread_cond_broadcast(cv);
+    else
+        pthread_cond_signal(cv);
+    pthread_mutex_unlock(m);
+    INSTR_COUNT(IC_SIGNALS);
+}
+
+cid takeoff(cqueue* q, pthread_mutex_t* m, pthread_cond_t* cv, atomic_int* sleepers,
+            int* open, struct timespec* until, int* more, snapcut* cut) {
+    cid c;
+    int timeout;
+    //Lock-free rings are tried before going near the mutex
+    if(q->mode == RING && (c = decqueue(q)) != CID_NONE) {
+        INSTR_COUNT(IC_TAKEOFFS);
+        *more = 1;
+        return c;
+    }
+    //Sleep until a customer shows up, the producers close or time is up,
+    //announcing ourselves before looking so a ring producer can't miss us
+    INSTR_LOCK(m);
+    atomic_fetch_add(sleepers, 1);
+    while((c = decqueue(q)) == CID_NONE && *open) {
+        INSTR_MARK(idled);
+        snap_stop(cut);
+        timeout = (pthread_cond_timedwait(cv, m, until) == ETIMEDOUT);
+        snap_go_locked(cut, m);
+        INSTR_SPAN(IK_IDLE, idled);
+        INSTR_COUNT(IC_COND_WAITS);
+        if(timeout)
+            break;
+    }
+    atomic_fetch_sub(sleepers, 1);
+    *more = *open;
+    pthread_mutex_unlock(m);
+    INSTR_COUNT(c != CID_NONE ? IC_TAKEOFFS : IC_IDLE_POLLS);
+    return c;
+}
+
+//Hand a batch of finished customers to a queue and wake a sleeper, a
+//mutex queue takes the whole batch under one lock
+void flush(cqueue* q, cqueue* batch, pthread_mutex_t* m, pthread_cond_t* cv, atomic_int* sleepers) {
+    cid c;
+    if(cqueue_length(batch) == 0)
+        return;
+    INSTR_COUNT(IC_FLUSHES);
+    if(q->mode == RING) {
+        while((c = decqueue(batch)) != CID_NONE)
+            encqueue(q, c);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(atomic_load(sleepers) == 0)
+            return;
+        INSTR_LOCK(m);
+        pthread_cond_signal(cv);
+        pthread_mutex_unlock(m);
+        INSTR_COUNT(IC_SIGNALS);
+        return;
+    }
+    INSTR_LOCK(m);
+    cqueue_splice(q, batch);
+    pthread_cond_signal(cv);
+    pthread_mutex_unlock(m);
+    INSTR_COUNT(IC_SIGNALS);
+}
+
+//Take everything a queue holds under one lock, as a chain linked by
+//next. The lock-free ring hands out one customer at a time.
+cid drain(cqueue* q, pthread_mutex_t* m) {
+    cid c;
+    if(q->mode == RING)
+        return decqueue(q);
+    INSTR_LOCK(m);
+    c = cqueue_detach(q);
+    pthread_mutex_unlock(m);
+    INSTR_COUNT(IC_DRAINS);
+    return c;
+}
+
+//Sleep until a waiting customer outranks the worst one this worker is
+//running or time is up, taking the customer and naming the server it
+//preempts
+cid contend(service_data* servd, simbusy* busy, cid* current, double* slice, double* ends,
+            long started, struct timespec* until, int* victim) {
+    cqueue*   q = servd->live;
+    carena*   a = servd->arena;
+    cid       c;
+    double    rank;
+    int       timeout;
+    INSTR_LOCK(servd->livelock);
+    atomic_fetch_add(servd->livesleep, 1);
+    while(1) {
+        *victim = sim_victim(busy, q->disc, a, current, slice, ends,
+                             elapsed(monotonic_ns(), started), &rank);
+        if((c = cqueue_peek(q)) != CID_NONE && *victim >= 0 && q->disc->rank(a, c, a->left[c]) < rank) {
+            c = decqueue(q);
+            break;
+        }
+        c = CID_NONE;
+        INSTR_MARK(idled);
+        snap_stop(servd->cut);
+        timeout = (pthread_cond_timedwait(servd->livecond, servd->livelock, until) == ETIMEDOUT);
+        snap_go_locked(servd->cut, servd->livelock);
+        INSTR_SPAN(IK_IDLE, idled);
+        INSTR_COUNT(IC_COND_WAITS);
+        if(timeout)
+            break;
+    }
+    atomic_fetch_sub(servd->livesleep, 1);
+    pthread_mutex_unlock(servd->livelock);
+    return c;
+}
+
+//Take a customer off a server after it was served for a while, to the
+//finished batch if that was all it was owed and to the back of the line
+//if not
+void retire(service_data* servd, srvstat* stats, cqueue* finished, cid c, double served,
+            long at, int i) {
+    carena* a = servd->arena;
+    a->left[c] = (served < a->left[c]) ? a->left[c] - served : 0;
+    if(a->left[c] > 0) {
+        handoff(servd->live, c, servd->livelock, servd->livecond, servd->livesleep);
+        return;
+    }
+    a->died[c] = at;
+    atomic_fetch_add_explicit(&stats[i].served, 1, memory_order_relaxed);
+    encqueue(finished, c);
+}
+
+void server_stats(srvstat* st, int n, double t, simresult* r) {
+    int i;
+    for(i = 0; i < n; i++) {
+        r->utilized[i] = 100*atomic_load_explicit(&st[i].worked, memory_order_relaxed)/t;
+        r->served[i]   = atomic_load_explicit(&st[i].served, memory_order_relaxed);
+    }
+}
+
+//Put a snapshot's customers back, those waiting in the order they would
+//have been served and those served in a chain for statistics to analyze
+//first. Returns -1 if they don't fit in the arena.
+int restore(snapshot* s, cqueue* live, long epoch, cid* backlog) {
+    carena*   a = live->arena;
+    snapcust* k;
+    cid       c, last = CID_NONE;
+    long      i;
+    for(i = 0; i < s->waiting; i++) {
+        //A LIFO line is built up from its back
+        k = &s->line[(live->mode == LIFO) ? s->waiting-1-i : i];
+        if((c = carena_get(a)) == CID_NONE)
+            return -1;
+        a->born[c] = epoch + k->born;
+        a->job[c]  = k->job;
+        a->left[c] = k->left;
+        a->prio[c] = k->prio;
+        encqueue(live, c);
+    }
+    *backlog = CID_NONE;
+    for(i = 0; i < s->served; i++) {
+        k = &s->done[i];
+        if((c = carena_get(a)) == CID_NONE)
+            return -1;
+        a->born[c] = epoch + k->born;
+        a->died[c] = epoch + k->died;
+        a->job[c]  = k->job;
+        a->next[c] = CID_NONE;
+        if(last == CID_NONE)
+            *backlog = c;
+        else
+            a->next[last] = c;
+        last = c;
+    }
+    return 0;
+}
+
+//Snapshot the run to statd->snapfile. Genesis and the workers are only
+//stopped while the customers in service go back in line with what they
+//are still owed and the process forks. The child's copy-on-write image
+//is the cut, it walks the queues and writes the file while the run goes
+//on, so the pause does not grow with the customers in the system.
+void checkpoint(statistics_data* statd, long analyzed, double worked, double sampled, double area) {
+    snapshot*     s     = statd->snap;
+    genesis_data* gensd = statd->gensd;
+    service_data* sd;
+    carena*       a     = statd->arena;
+    long          now;
+    double        r;
+    cid           c;
+    pid_t         pid;
+    int           w, i;
+
+    INSTR_MARK(cutting);
+    if(snap_cut(statd->cut)) {
+        statd->snapfails++;
+        return;
+    }
+    now = monotonic_ns();
+    snapshot_begin(s, a, statd->epoch, now);
+    s->gen       = gensd->gen;
+    s->gen.due  -= statd->epoch;
+    s->cursor    = gensd->replay ? (long)(gensd->gen.cursor.pos - (const unsigned char*)gensd->replay->base) : 0;
+    s->stop      = atomic_load(statd->stop);
+    for(i = 0; i < statd->servers; i++) {
+        s->worked[i]   = atomic_load_explicit(&statd->stats[i].worked, memory_order_relaxed);
+        s->finished[i] = atomic_load_explicit(&statd->stats[i].served, memory_order_relaxed);
+    }
+    //Service not given yet comes off the servers' work, a customer whose
+    //slice is over is served even if the worker has not seen it yet
+    for(w = 0; w < statd->workers; w++) {
+        sd = &statd->servd[w];
+        for(i = 0; sd->current != NULL && i < sd->count; i++) {
+            if((c = sd->current[i]) == CID_NONE)
+                continue;
+            r = sd->ends[i] - elapsed(now, sd->started);
+            r = (r > 0) ? r : 0;
+            s->worked[sd->first+i] -= r;
+            if(a->left[c] - (sd->slice[i] - r) > 0) {
+                snapshot_wait(s, c, a->left[c] - (sd->slice[i] - r));
+            } else {
+                snapshot_done(s, c, sd->started + nanoseconds(sd->ends[i]));
+                s->finished[sd->first+i]++;
+            }
+        }
+    }
+    cqueue_account_save(statd->live, &s->length);
+    pid = fork();
+    snap_release(statd->cut);
+    INSTR_SPAN(IK_SNAPSHOT, cutting);
+    if(pid < 0) {
+        statd->snapfails++;
+        return;
+    }
+    if(pid > 0) {
+        statd->writer = pid;
+        return;
+    }
+
+    //Child, with the run as it stood at the cut and no other thread. The
+    //queues are walked in the order they hand customers out. Profiled
+    //runs integrate the queue length up to the cut, where a resumed run
+    //reads on from.
+    cqueue_walk(statd->live, snap_waiting, s);
+    for(w = 0; w < statd->workers; w++)
+        cqueue_walk(statd->servd[w].finished, snap_served, s);
+    cqueue_walk(statd->dead, snap_served, s);
+    if(statd->profile)
+        integrate(statd, &sampled, &area, elapsed(now, statd->epoch),
+                  cqstats_area(&s->length, elapsed(now, statd->epoch)));
+    s->analyzed = analyzed;
+    s->work     = worked;
+    s->sampled  = sampled;
+    *s->wait    = *statd->result->wait;
+    *s->sojourn = *statd->result->sojourn;
+    memcpy(s->windows, statd->result->windows, sizeof(s->windows));
+    if(statd->steady)
+        steady_copy(s->steady, statd->steady);
+    _exit((s->failed || snapshot_save(s, statd->snapfile, statd->whole)) ? 1 : 0);
+}
+
+//Collect the process writing the last snapshot once it is done, waiting
+//for it if block is set. Returns nonzero while it is still writing. A
+//snapshot that failed leaves the file to be written whole next time.
+int settle(statistics_data* statd, int block) {
+    int   status;
+    pid_t pid;
+    if(statd->writer <= 0)
+        return 0;
+    while((pid = waitpid(statd->writer, &status, block ? 0 : WNOHANG)) < 0 && errno == EINTR);
+    if(pid == 0)
+        return -1;
+    if(pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        statd->snapfails++;
+        statd->whole = 1;
+    } else {
+        statd->whole = 0;
+    }
+    statd->writer = 0;
+    return 0;
+}
+
+//Spread the queue length integrated since the last reading evenly over
+//the windows up to this one. Readings are taken at window edges, so no
+//window's integral leaks into another.
+void integrate(statistics_data* statd, double* sampled, double* area, double at, double to) {
+    if(at > *sampled)
+        profile_integrate(statd->profile, statd->result->windows, *sampled, at, (to - *area)/(at - *sampled));
+    *sampled = at;
+    *area    = to;
+}
+
+double wall_clock(void* epoch) {
+    return elapsed(monotonic_ns(), *(long*)epoch);
 }
 
 void* genesis(void* targ) {
     genesis_data* gensd = (genesis_data*)targ;
-    customer* c = NULL;
-    timeval birthday;
-    int customers_left;
+    snapgen* g = &gensd->gen;
+    carena* a = gensd->arena;
+    cid c = CID_NONE;
+    long late;
+    double next;
 
-    srand48(gensd->rseed);
+    INSTR_THREAD("genesis", -1);
+    //A resumed run has its generator from the snapshot, the next arrival
+    //already laid out
+    if(!gensd->resumed) {
+        //Same stream the virtual time engine draws for this seed
+        rng_seed(&g->random, (unsigned long)gensd->rseed, 0);
+        g->classes = g->random;
+        rng_skip(&g->classes, 1UL << 62);
+        expblock_init(&g->draws, &g->random);
+        g->made  = 0;
+        g->done  = 0;
+        g->delta = 0;
+        g->job   = 0;
+        g->at    = 0;
+        //Arrivals are due at absolute times, a late wake-up delays one
+        //customer instead of pushing back every customer after it
+        g->due = monotonic_ns();
+        //A replayed customer waits out its own interarrival time first
+        if(gensd->replay) {
+            trace_cursor(gensd->replay, &g->cursor);
+            if(trace_next(&g->cursor, &g->delta, &g->job))
+                g->due += nanoseconds(g->delta);
+            else
+                g->done = 1;
+        }
+        //A profile lays arrivals out from the start of the run, the first
+        //one coming the first moment the profile has any
+        if(gensd->profile) {
+            profile_cursor(&g->pace);
+            g->delta = g->at = profile_next(gensd->profile, &g->pace, 0);
+            g->due   = gensd->epoch + nanoseconds(g->at);
+        }
+    }
 
-    sem_getvalue(gensd->customers_left, &customers_left);
-    while(customers_left > 0) {
-        //Get a blank customer from source and initialize it
-        gettimeofday(&birthday,NULL);
-        c = decqueue(gensd->source);
-        c->born = birthday;
-        c->job  = rexp(gensd->mu);
+    while(!g->done && g->made < gensd->customers && !atomic_load_explicit(gensd->stop, memory_order_relaxed)) {
+        //Snapshots are cut while waiting for the next arrival, the one
+        //time genesis holds no customer
+        snap_stop(gensd->cut);
+        late = sleep_until(g->due);
+        snap_go(gensd->cut);
+        tally_add(gensd->slack, late/1e9);
+        if(!gensd->replay)
+            g->job = dist_next(gensd->service, &g->draws)/gensd->mu;
 
-        //Enqueue new customer
-        pthread_mutex_lock(gensd->livelock);
-        encqueue(gensd->live, c);
-        pthread_mutex_unlock(gensd->livelock);
+        //Get a blank customer from the arena and initialize it, born when
+        //it actually shows up so waits measure queueing and not the timer
+        c = carena_get(a);
+        if(c == CID_NONE) {
+            screen_end();
+            printf("Error: customer memory allocation failed\n");
+            exit(-1);
+        }
+        a->born[c] = g->due + late;
+        a->job[c]  = g->job;
+        a->left[c] = g->job;
+        a->prio[c] = (gensd->classes > 1) ? (int)(rng_uniform(&g->classes)*gensd->classes) : 0;
+        if(gensd->record)
+            trace_write(gensd->record, g->delta, g->job);
 
-        //Decrement customers left and set loop control
-        sem_wait(gensd->customers_left);
-        sem_getvalue(gensd->customers_left, &customers_left);
+        //Enqueue new customer and wake an idle server
+        handoff(gensd->live, c, gensd->livelock, gensd->livecond, gensd->livesleep);
+        g->made++;
 
-        //Sleep until next customer arrives
-        psleep(rexp(gensd->lambda));
+        //Schedule next customer
+        if(g->made >= gensd->customers) {
+            break;
+        } else if(gensd->replay) {
+            if(trace_next(&g->cursor, &g->delta, &g->job))
+                g->due += nanoseconds(g->delta);
+            else
+                g->done = 1;
+        } else if(gensd->profile) {
+            next     = profile_next(gensd->profile, &g->pace, dist_next(gensd->arrivals, &g->draws));
+            g->delta = next - g->at;
+            g->at    = next;
+            g->due   = gensd->epoch + nanoseconds(g->at);
+        } else {
+            g->delta = dist_next(gensd->arrivals, &g->draws)/gensd->lambda;
+            g->due  += nanoseconds(g->delta);
+        }
     }
+    //Genesis stays stopped for every snapshot from here on
+    g->done = 1;
+    snap_stop(gensd->cut);
 
+    //Tell idle servers no one else is coming
+    INSTR_LOCK(gensd->livelock);
+    *gensd->generating = 0;
+    pthread_cond_broadcast(gensd->livecond);
+    pthread_mutex_unlock(gensd->livelock);
     return NULL;
 }
 
 void* service(void* targ) {
     service_data* servd = (service_data*)targ;
-    customer* c = NULL;
-    timeval deathday, started, now;
-    int customers_left, served = 0;
-    double utilized, worked = 0;
+    srvstat* stats = servd->stats + servd->first;
+    const cqdisc* disc = servd->live->disc;
+    carena*    a = servd->arena;
+    cid*       current; //Customer each server is working on
+    double*    slice;   //Service the running slice of each server covers
+    double*    ends;    //Time the running slice of each server ends, in seconds since started
+    int*       idle;    //Stack of idle servers
+    simbusy    busy;    //Busy servers by their customer's preemption rank
+    evlist     done;    //Service completions, in seconds since started
+    cqueue*    finished; //Customers done but not yet flushed to the dead queue
+    event      e;
+    cid c = CID_NONE;
+    long started, now, flushed;
+    struct timespec until;
+    int i, nidle, generating = 1;
+    double t;
+
+    INSTR_THREAD("service", servd->stid);
+    current = (cid*)calloc(servd->count, sizeof(cid));
+    slice   = (double*)malloc(servd->count*sizeof(double));
+    ends    = (double*)malloc(servd->count*sizeof(double));
+    idle    = (int*)malloc(servd->count*sizeof(int));
+    finished = new_cqueue(FIFO, a);
+    if(!current || !slice || !ends || !idle || !finished || evlist_init(&done, servd->count) ||
+       simbusy_init(&busy, servd->count)) {
+        screen_end();
+        printf("Error: service thread memory allocation failed\n");
+        exit(-1);
+    }
+    //First server ends up on top of the idle stack
+    for(i = 0; i < servd->count; i++)
+        idle[i] = servd->count-1-i;
+    nidle = servd->count;
 
-    gettimeofday(&started, NULL);
+    started = flushed = monotonic_ns();
+    //Snapshots read what the servers hold while the worker is stopped
+    servd->current  = current;
+    servd->slice    = slice;
+    servd->ends     = ends;
+    servd->started  = started;
+    servd->finished = finished;
     while(1) {
-        //Dequeue live customer
-        pthread_mutex_lock(servd->livelock);
-        c = decqueue(servd->live);
-        pthread_mutex_unlock(servd->livelock);
+        //Top of the loop is a safe point, a busy worker may not wait
+        //anywhere for a while
+        snap_yield(servd->cut);
+        //Set every customer whose service is up aside for the dead queue,
+        //completions are compared in nanoseconds so a wake-up at the
+        //deadline always finds its customer done
+        now = monotonic_ns();
+        while(evlist_peek(&done, &e) && started + nanoseconds(e.time) <= now) {
+            evlist_pop(&done, &e);
+            tally_add(servd->slack, elapsed(now, started + nanoseconds(e.time)));
+            i = e.server;
+            retire(servd, stats, finished, current[i], slice[i], started + nanoseconds(e.time), i);
+            simbusy_remove(&busy, i);
+            current[i] = CID_NONE;
+            idle[nidle++] = i;
+        }
+        //Finished customers reach statistics in batches, a full one or
+        //whatever is left once in a while or before idling with no
+        //completion due to wake us
+        if(cqueue_length(finished) >= FLUSH_BATCH || now - flushed >= nanoseconds(FLUSH_INTERVAL) ||
+           (nidle == servd->count && cqueue_length(servd->live) == 0)) {
+            flush(servd->dead, finished, servd->deadlock, servd->deadcond, servd->deadsleep);
+            flushed = now;
+        }
 
-        //Check to see if there is no more work
-        sem_getvalue(servd->customers_left, &customers_left);
-        if(customers_left == 0 && c == NULL) {
-            break;
+        if(nidle == 0) {
+            //Every server is busy, sleep until the first one is done
+            if(disc->rank == NULL) {
+                snap_stop(servd->cut);
+                sleep_until(started + nanoseconds(done.heap[0].time));
+                snap_go(servd->cut);
+                continue;
+            }
+            //Unless a waiting customer may take a server first, the
+            //running one goes back in line with what it is still owed
+            deadline(&until, started + nanoseconds(done.heap[0].time));
+            if((c = contend(servd, &busy, current, slice, ends, started, &until, &i)) == CID_NONE)
+                continue;
+            evlist_cancel(&done, i);
+            simbusy_remove(&busy, i);
+            t = elapsed(monotonic_ns(), started);
+            t = (ends[i] > t) ? ends[i] - t : 0;
+            slice[i] -= t;
+            atomic_store_explicit(&stats[i].worked, stats[i].worked - t, memory_order_relaxed);
+            retire(servd, stats, finished, current[i], slice[i], started + nanoseconds(ends[i]-t), i);
+            current[i] = CID_NONE;
+            idle[nidle++] = i;
+        } else {
+            //Dequeue live customer, sleeping until one arrives or the next
+            //busy server is done
+            if(evlist_peek(&done, &e))
+                deadline(&until, started + nanoseconds(e.time));
+            else
+                deadline(&until, now + nanoseconds(IDLE_INTERVAL));
+            c = takeoff(servd->live, servd->livelock, servd->livecond, servd->livesleep,
+                        servd->generating, &until, &generating, servd->cut);
         }
 
         //No customer in line apparently, idle
-        if(c == NULL) {
-            //Calculate utilization and update display
-            gettimeofday(&now,NULL);
-            utilized = 100*worked/time_elapsed(now,started);
-            pthread_mutex_lock(servd->displock);
-            update_server(servd->stid,utilized,served);
-            pthread_mutex_unlock(servd->displock);
-            psleep(0.01);
+        if(c == CID_NONE) {
+            //Check to see if there is no more work
+            if(generating)
+                continue;
+            if(!evlist_peek(&done, &e))
+                break;
+            //Genesis is done, only the busy servers are left to finish
+            snap_stop(servd->cut);
+            sleep_until(started + nanoseconds(e.time));
+            snap_go(servd->cut);
             continue;
         }
 
-        //Service customer
-        worked += c->job;
-        gettimeofday(&deathday,NULL);
-        c->died = deathday;
-        psleep(c->job);
-        served++;
-
-        //Calculate utilization and update display
-        utilized = 100*worked/time_elapsed(deathday,started);
-        pthread_mutex_lock(servd->displock);
-        update_server(servd->stid,utilized,served);
-        pthread_mutex_unlock(servd->displock);
-
-        //Enqueue customer in dead queue
-        pthread_mutex_lock(servd->deadlock);
-        encqueue(servd->dead, c);
-        pthread_mutex_unlock(servd->deadlock);
-    }
-
-    //Final dipslay update
-    gettimeofday(&deathday,NULL);
-    utilized = 100*worked/time_elapsed(deathday,started);
-    pthread_mutex_lock(servd->displock);
-    update_server(servd->stid,utilized,served);
-    pthread_mutex_unlock(servd->displock);
-    sem_wait(servd->servers_left);
+        //Service customer on an idle server for as much of what it is
+        //owed as the quantum allows
+        i = idle[--nidle];
+        now = monotonic_ns();
+        current[i] = c;
+        slice[i]   = (servd->quantum > 0 && a->left[c] > servd->quantum) ? servd->quantum : a->left[c];
+        ends[i]    = elapsed(now, started) + slice[i];
+        atomic_store_explicit(&stats[i].worked, stats[i].worked + slice[i], memory_order_relaxed);
+        evlist_push(&done, ends[i], DEPARTURE, i);
+        if(disc->rank)
+            simbusy_add(&busy, i, sim_key(disc, a, c, slice[i], ends[i]));
+    }
+
+    //Nothing is left behind for statistics to miss, the worker stays
+    //stopped for every snapshot from here on
+    flush(servd->dead, finished, servd->deadlock, servd->deadcond, servd->deadsleep);
+    servd->current  = NULL;
+    servd->finished = NULL;
+    snap_stop(servd->cut);
+    destroy_cqueue(finished);
+    evlist_free(&done);
+    simbusy_free(&busy);
+    free(current);
+    free(slice);
+    free(ends);
+    free(idle);
+
+    //Check out, the last worker lets statistics finish
+    INSTR_LOCK(servd->deadlock);
+    (*servd->serving)--;
+    pthread_cond_broadcast(servd->deadcond);
+    pthread_mutex_unlock(servd->deadlock);
     return NULL;
 }
 
 void* statistics(void* targ) {
     statistics_data* statd = (statistics_data*)targ;
-    timeval started, now;
-    customer* c;
-    int l, customers_left, servers_left;
+    long started, now, due, snapdue;
+    struct timespec wake;
+    carena* a = statd->arena;
+    cid c;
+    cid last;
+    winstat* w;
+    int serving = 1, n;
     double t, sigma, average, worked = 0;
-    //Variables for sigma of queue length
-    int    qlen_ssq = 0; //Sum of the squares of the lengths of queue
-    int    qlen_sum = 0; //Sum of the lengths of queue
-    int    polled   = 0; //Number of times the queue length was polled
-    //Variables for sigma of wait time
-    double wait_ssq = 0; //Sum of the squares of the wait time
-    double wait_sum = 0; //Sum of the wait time
-    int    analyzed = 0; //Number of customers analyzed
+    double sampled  = 0;                      //Run time the queue length was last integrated up to
+    double area     = 0;                      //Queue length integrated up to sampled
+    double at, to;
+    tally* wait     = statd->result->wait;    //Wait time of analyzed customers
+    tally* sojourn  = statd->result->sojourn; //Time in the system of analyzed customers
+    int    analyzed = 0;                      //Number of customers analyzed
 
+    INSTR_THREAD("statistics", -1);
     //Initialize statistics output
-    pthread_mutex_lock(statd->displock);
-    update_wait_stats(0,0);
-    update_queue_stats(0,0);
-    pthread_mutex_unlock(statd->displock);
+    if(!statd->headless) {
+        INSTR_LOCK(statd->displock);
+        update_wait_stats(0,0);
+        update_queue_stats(0,0);
+        pthread_mutex_unlock(statd->displock);
+    }
 
-    gettimeofday(&started,NULL);
+    //First pass is due immediately, a resumed run counts its time from
+    //the start of the run it carries on
+    started = due = monotonic_ns();
+    snapdue = started + nanoseconds(statd->snapevery);
+    if(statd->resume) {
+        started  = statd->epoch;
+        analyzed = statd->resume->analyzed;
+        worked   = statd->resume->work;
+        sampled  = statd->resume->sampled;
+        area     = cqstats_area(&statd->resume->length, sampled);
+    }
+    //Customers the snapshot found served come first
+    c = statd->backlog;
+    deadline(&wake, due);
     while(1) {
-        //Dequeue dead customer
-        pthread_mutex_lock(statd->deadlock);
-        c = decqueue(statd->dead);
-        pthread_mutex_unlock(statd->deadlock);
+        //Dequeue dead customer, sleeping until one is serviced or the
+        //display is due for a refresh
+        if(c == CID_NONE)
+            c = takeoff(statd->dead, statd->deadlock, statd->deadcond, statd->deadsleep,
+                        statd->serving, &wake, &serving, NULL);
 
         //Check to see if there is no more work
-        sem_getvalue(statd->customers_left, &customers_left);
-        sem_getvalue(statd->servers_left, &servers_left);
-        if(customers_left == 0 && servers_left == 0 && c == NULL) {
+        if(c == CID_NONE && serving == 0) {
             break;
         }
 
+        //Analyze all dead customers, taking whatever piled up behind the
+        //first in one go, and recycle each chain at once. A chain only
+        //reads the arena's next, born, died and job columns.
+        INSTR_MARK(analyzing);
+        while(c != CID_NONE) {
+            for(last = c, n = 1; ; last = a->next[last], n++) {
+                //Waits shorter than the clock's nanosecond are none at all
+                t = elapsed(a->died[last],a->born[last]) - a->job[last];
+                t = (t < 1e-9) ? 0 : t;
+                analyzed++;
+                tally_add(wait, t);
+                tally_add(sojourn, t + a->job[last]);
+                //Profiled runs break waits down by when customers arrived
+                if(statd->profile) {
+                    w = &statd->result->windows[profile_window(statd->profile, elapsed(a->born[last], statd->epoch))];
+                    w->arrived++;
+                    w->wait += t;
+                }
+                //Once the precision is there genesis stops, the rest finish
+                if(statd->steady && !atomic_load(statd->stop) && steady_add(statd->steady, t))
+                    atomic_store(statd->stop, 1);
+                worked   += a->job[last];
+                if(a->next[last] == CID_NONE)
+                    break;
+            }
+            //Hand the customers back for genesis to reuse
+            carena_put_chain(a, c, last, n);
+            c = drain(statd->dead, statd->deadlock);
+        }
+        INSTR_SPAN(IK_ANALYZE, analyzing);
+
+        //Snapshots are taken between passes, with nothing analyzed in part,
+        //and not before the last one is written
+        now = monotonic_ns();
+        if(statd->cut && now >= snapdue && settle(statd, 0) == 0) {
+            checkpoint(statd, analyzed, worked, sampled, area);
+            now     = monotonic_ns();
+            snapdue = now + nanoseconds(statd->snapevery);
+        }
+
+        //Display only happens once per interval, the queue keeps its own
+        //length statistics so there is nothing to sample without it
+        if(now < due)
+            continue;
+        due = now + nanoseconds(statd->headless ? IDLE_INTERVAL : DISPLAY_INTERVAL);
+        //Profiled runs also pass at every window edge, where the queue's
+        //own length integral is read, so each window gets exactly its own
+        if(statd->profile && cqueue_length_area(statd->live, &at, &to) == 0) {
+            integrate(statd, &sampled, &area, at, to);
+            if(statd->epoch + nanoseconds(profile_edge(statd->profile, at)) < due)
+                due = statd->epoch + nanoseconds(profile_edge(statd->profile, at));
+        }
+        deadline(&wake, due);
+        if(statd->headless)
+            continue;
+
         //Update Progress
-        gettimeofday(&now,NULL);
-        t = time_elapsed(now,started);
-        pthread_mutex_lock(statd->displock);
+        t = elapsed(now,started);
+        INSTR_LOCK(statd->displock);
         update_progress(t,100*worked/t,analyzed,statd->customers, statd->servers);
         pthread_mutex_unlock(statd->displock);
 
-        //Get the live customer count
-        pthread_mutex_lock(statd->livelock);
-        l = statd->live->count;
-        pthread_mutex_unlock(statd->livelock);
+        //Update server statistics
+        server_stats(statd->stats, statd->servers, t, statd->result);
+        INSTR_LOCK(statd->displock);
+        update_servers(statd->servers, statd->result->utilized, statd->result->served);
+        pthread_mutex_unlock(statd->displock);
 
         //Update queue length statistics
-        polled++;
-        qlen_sum += l;
-        qlen_ssq += l*l;
-        if(polled > 1) {
-            average = qlen_sum/(double)polled;
-            sigma   = qlen_ssq - (qlen_sum*qlen_sum)/(double)polled;
-            sigma   = sigma/(polled-1);
-            sigma   = sqrt(sigma);
-            pthread_mutex_lock(statd->displock);
+        if(cqueue_length_stats(statd->live, &average, &sigma, NULL) == 0) {
+            INSTR_LOCK(statd->displock);
             update_queue_stats(average, sigma);
             pthread_mutex_unlock(statd->displock);
         }
 
-        //No customer to analyze
-        if(c == NULL) {
-            psleep(0.02);
-            continue;
-        }
-
-        //Analyze all dead customers and destroy them
-        while(c != NULL) {
-            t = time_elapsed(c->died,c->born);
-            analyzed++;
-            wait_sum += t;
-            wait_ssq += t*t;
-            worked   += c->job;
-            //Don't need mutex only other thread that
-            //uses free and malloc is main and it waits
-            //on this thread
-            destroy_customer(c);
-            //Dequeue dead customer
-            pthread_mutex_lock(statd->deadlock);
-            c = decqueue(statd->dead);
-            pthread_mutex_unlock(statd->deadlock);
-        }
         //Update wait statistics
         if(analyzed > 1) {
-            average = wait_sum/analyzed;
-            sigma   = wait_ssq - (wait_sum*wait_sum)/analyzed;
-            sigma   = sigma/(analyzed-1);
-            sigma   = sqrt(sigma);
-            pthread_mutex_lock(statd->displock);
-            update_wait_stats(average, sigma);
+            INSTR_LOCK(statd->displock);
+            update_wait_stats(tally_mean(wait), tally_sigma(wait));
             pthread_mutex_unlock(statd->displock);
         }
-        psleep(0.02);
     }
 
-    //Update Progress
-    gettimeofday(&now,NULL);
-    t = time_elapsed(now,started);
-    pthread_mutex_lock(statd->displock);
+    //The last snapshot is on the disk before the run ends
+    settle(statd, 1);
+
+    //Final statistics are kept for the report
+    if(statd->profile && cqueue_length_area(statd->live, &at, &to) == 0)
+        integrate(statd, &sampled, &area, at, to);
+    t = elapsed(monotonic_ns(),started);
+    statd->result->elapsed  = t;
+    statd->result->analyzed = analyzed;
+    statd->result->worked   = worked;
+    server_stats(statd->stats, statd->servers, t, statd->result);
+    //Final queue length statistics
+    cqueue_length_stats(statd->live, &statd->result->qlen_avg, &statd->result->qlen_sigma,
+                        statd->result->qlen_share);
+    //Final wait time statistics
+    statd->result->wait_avg   = tally_mean(wait);
+    statd->result->wait_sigma = tally_sigma(wait);
+    if(statd->steady) {
+        steady_check(statd->steady);
+        statd->result->warmup      = statd->steady->warmup;
+        statd->result->wait_steady = statd->steady->mean;
+        statd->result->wait_ci95   = statd->steady->half;
+        statd->result->converged   = atomic_load(statd->stop);
+    }
+    if(statd->headless)
+        return NULL;
+
+    //Final display update
+    INSTR_LOCK(statd->displock);
     update_progress(t,100*worked/t,analyzed,statd->customers, statd->servers);
-    pthread_mutex_unlock(statd->displock);
-    //Final queue length statistics update
-    average = qlen_sum/(double)polled;
-    sigma   = qlen_ssq - (qlen_sum*qlen_sum)/(double)polled;
-    sigma   = sigma/(polled-1);
-    sigma   = sqrt(sigma);
-    pthread_mutex_lock(statd->displock);
-    update_queue_stats(average, sigma);
-    pthread_mutex_unlock(statd->displock);
-    //Final wait time statistics update
-    average = wait_sum/analyzed;
-    sigma   = wait_ssq - (wait_sum*wait_sum)/analyzed;
-    sigma   = sigma/(analyzed-1);
-    sigma   = sqrt(sigma);
-    pthread_mutex_lock(statd->displock);
-    update_wait_stats(average, sigma);
+    update_servers(statd->servers, statd->result->utilized, statd->result->served);
+    update_queue_stats(statd->result->qlen_avg, statd->result->qlen_sigma);
+    update_wait_stats(statd->result->wait_avg, statd->result->wait_sigma);
     pthread_mutex_unlock(statd->displock);
 
     return NULL;
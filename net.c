@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "net.h"
+#include "evlist.h"
+#include "rng.h"
+
+//Working state of one network run. Servers of every station are numbered
+//one after the other, station s owning st[s].servers of them from
+//st[s].first, so the per server arrays are shared by all stations.
+typedef struct _netrun {
+    network*         net;             //Reference to the network being run
+    simconfig*       cfg;             //Reference to the run's parameters
+    netresult*       res;             //Reference to the results being kept
+    evlist           events;          //Future event list, arrivals carry the station and departures the server
+    cqueue**         live;            //Queue of each station
+    carena*          arena;           //Recycled customers, the only customer memory there is
+    cid*             current;         //Customer each server is working on (CID_NONE when idle)
+    double*          slice;           //Service the running slice of each server covers
+    double*          ends;            //Time the running slice of each server ends
+    simbusy*         busy;            //Busy servers of each station by preemption rank, counted from its first
+    int*             owner;           //Station of each server
+    int*             idle;            //Idle servers of each station, stacked from its first server
+    int*             nidle;           //Number of idle servers at each station
+    int*             dirty;           //Stations changed since they were last served
+    int              ndirty;          //Number of stations on dirty
+    char*            marked;          //Station is on dirty
+    rng              random;          //Workload and routing draws
+    rng              classes;         //Priority classes, drawn apart so the workload stays the same
+    expblock         draws;           //Unit exponentials generated a block at a time
+    double           now;             //Simulated clock, read by the queue accounting
+} netrun;
+
+static int    _solve(network* net);
+static double _nclock(void* now);
+static long   _nns(double seconds);
+static void   _touch(netrun* r, int s);
+static void   _arrive(netrun* r, int s, cid c);
+static void   _route(netrun* r, int s, cid c);
+static void   _start(netrun* r, int g, cid c);
+static void   _depart(netrun* r, int g);
+static void   _serve(netrun* r, int s);
+static void   _release(netrun* r);
+
+//Networks are read from lines of two kinds, stations numbered from 1 in
+//the order they are given:
+//  station servers mu discipline lambda
+//  route from to probability
+//lambda is the rate of arrivals from outside, routes out of a station may
+//add up to at most one and whatever they leave over exits the network.
+//Lines starting with '#' are comments. Returns NULL on a bad file or a
+//network customers can't leave.
+network* new_network(const char* path) {
+    FILE*    in;
+    network* net;
+    station* s;
+    char     line[256], kind[16], disc[64];
+    int      size = 0, nroutes = 0, rsize = 0, from, to, i, bad = 0;
+    double   p, arg;
+    int*     rfrom = NULL;
+    int*     rto = NULL;
+    double*  rp = NULL;
+    void*    grown;
+
+    if((in = fopen(path, "r")) == NULL)
+        return NULL;
+    if((net = (network*)calloc(1, sizeof(network))) == NULL || (net->path = strdup(path)) == NULL) {
+        free(net);
+        fclose(in);
+        return NULL;
+    }
+    while(!bad && fgets(line, sizeof(line), in)) {
+        if(line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if(sscanf(line, "%15s", kind) != 1) {
+            bad = 1;
+        } else if(!strcmp(kind, "station")) {
+            if(net->count == size) {
+                size = size ? 2*size : 16;
+                if(size > NET_STATIONS || (grown = realloc(net->st, size*sizeof(station))) == NULL) {
+                    bad = 1;
+                    break;
+                }
+                net->st = (station*)grown;
+            }
+            s = &net->st[net->count];
+            memset(s, 0, sizeof(station));
+            if(sscanf(line, "%*s %d %lf %63s %lf", &s->servers, &s->mu, disc, &s->lambda) != 4 ||
+               s->servers < 1 || !(s->mu > 0) || s->lambda < 0 || cqmode_parse(disc, &s->mode, &arg)) {
+                bad = 1;
+                break;
+            }
+            //Same defaults a single station run gets
+            s->quantum = (s->mode == RR) ? ((arg > 0) ? arg : 0.1/s->mu) : 0;
+            s->classes = (s->mode == PRIO) ? ((arg >= 1) ? ((arg < CQ_CLASSES) ? (int)arg : CQ_CLASSES) : 2) : 1;
+            s->first   = net->servers;
+            net->servers += s->servers;
+            net->count++;
+        } else if(!strcmp(kind, "route")) {
+            if(nroutes == rsize) {
+                rsize = rsize ? 2*rsize : 64;
+                if((grown = realloc(rfrom, rsize*sizeof(int))) == NULL) {
+                    bad = 1;
+                    break;
+                }
+                rfrom = (int*)grown;
+                if((grown = realloc(rto, rsize*sizeof(int))) == NULL) {
+                    bad = 1;
+                    break;
+                }
+                rto = (int*)grown;
+                if((grown = realloc(rp, rsize*sizeof(double))) == NULL) {
+                    bad = 1;
+                    break;
+                }
+                rp = (double*)grown;
+            }
+            if(sscanf(line, "%*s %d %d %lf", &from, &to, &p) != 3 || p < 0 || p > 1) {
+                bad = 1;
+                break;
+            }
+            rfrom[nroutes] = from-1;
+            rto[nroutes]   = to-1;
+            rp[nroutes]    = p;
+            nroutes++;
+        } else {
+            bad = 1;
+        }
+    }
+    fclose(in);
+
+    //Routes are checked once every station is known
+    for(i = 0; !bad && i < nroutes; i++)
+        bad = rfrom[i] < 0 || rfrom[i] >= net->count || rto[i] < 0 || rto[i] >= net->count;
+    for(i = 0; !bad && i < net->count; i++) {
+        s = &net->st[i];
+        s->to   = (int*)malloc((nroutes ? nroutes : 1)*sizeof(int));
+        s->upto = (double*)malloc((nroutes ? nroutes : 1)*sizeof(double));
+        bad = (s->to == NULL || s->upto == NULL);
+    }
+    for(i = 0; !bad && i < nroutes; i++) {
+        s = &net->st[rfrom[i]];
+        s->to[s->routes]   = rto[i];
+        s->upto[s->routes] = (s->routes ? s->upto[s->routes-1] : 0) + rp[i];
+        bad = s->upto[s->routes] > 1 + 1e-9;
+        s->routes++;
+    }
+    free(rfrom);
+    free(rto);
+    free(rp);
+    if(bad || net->count == 0 || _solve(net)) {
+        destroy_network(net);
+        return NULL;
+    }
+    return net;
+}
+
+void destroy_network(network* net) {
+    int i;
+    if(net == NULL)
+        return;
+    for(i = 0; net->st && i < net->count; i++) {
+        free(net->st[i].to);
+        free(net->st[i].upto);
+    }
+    free(net->st);
+    free(net->path);
+    free(net);
+    return;
+}
+
+//First station whose servers can't keep up with what the traffic
+//equations send it, -1 if every one can
+int network_overloaded(network* net) {
+    int i;
+    for(i = 0; i < net->count; i++)
+        if(net->st[i].rate >= net->st[i].servers*net->st[i].mu)
+            return i;
+    return -1;
+}
+
+netresult* new_netresult(int n) {
+    netresult* r = (netresult*)calloc(1, sizeof(netresult));
+    int i;
+    if(r == NULL)
+        return NULL;
+    r->stations = n;
+    r->visits   = (long*)calloc(n, sizeof(long));
+    r->utilized = (double*)calloc(n, sizeof(double));
+    r->qlen_avg = (double*)calloc(n, sizeof(double));
+    r->wait     = (tally**)calloc(n, sizeof(tally*));
+    r->sojourn  = (tally**)calloc(n, sizeof(tally*));
+    r->total    = new_tally();
+    if(!r->visits || !r->utilized || !r->qlen_avg || !r->wait || !r->sojourn || !r->total) {
+        destroy_netresult(r);
+        return NULL;
+    }
+    for(i = 0; i < n; i++) {
+        if((r->wait[i] = new_tally()) == NULL || (r->sojourn[i] = new_tally()) == NULL) {
+            destroy_netresult(r);
+            return NULL;
+        }
+    }
+    return r;
+}
+
+void destroy_netresult(netresult* r) {
+    int i;
+    if(r == NULL)
+        return;
+    for(i = 0; i < r->stations; i++) {
+        if(r->wait)
+            destroy_tally(r->wait[i]);
+        if(r->sojourn)
+            destroy_tally(r->sojourn[i]);
+    }
+    free(r->visits);
+    free(r->utilized);
+    free(r->qlen_avg);
+    free(r->wait);
+    free(r->sojourn);
+    destroy_tally(r->total);
+    free(r);
+    return;
+}
+
+//Runs the network in virtual time until cfg->customers have come in from
+//outside and every one of them has left. Customers move from station to
+//station in place, a hop costs an enqueue and an event, never memory.
+int net_run(network* net, simconfig* cfg, netresult* res) {
+    netrun    run;
+    netrun*   r = &run;
+    event     e;
+    cid       c;
+    station*  s;
+    double    t;
+    int       i, k, g, status = 0, generated = 0;
+
+    if(net == NULL || cfg == NULL || res == NULL || res->stations < net->count)
+        return -1;
+    memset(r, 0, sizeof(netrun));
+    r->net = net;
+    r->cfg = cfg;
+    r->res = res;
+    r->live    = (cqueue**)calloc(net->count, sizeof(cqueue*));
+    r->nidle   = (int*)malloc(net->count*sizeof(int));
+    r->dirty   = (int*)malloc(net->count*sizeof(int));
+    r->marked  = (char*)calloc(net->count, sizeof(char));
+    r->current = (cid*)calloc(net->servers, sizeof(cid));
+    r->slice   = (double*)malloc(net->servers*sizeof(double));
+    r->ends    = (double*)malloc(net->servers*sizeof(double));
+    r->owner   = (int*)malloc(net->servers*sizeof(int));
+    r->busy    = (simbusy*)calloc(net->count, sizeof(simbusy));
+    r->idle    = (int*)malloc(net->servers*sizeof(int));
+    r->arena   = new_carena((cfg->customers > 0) ? cfg->customers : 1);
+    //One pending arrival per station plus at most one departure per server
+    if(!r->live || !r->nidle || !r->dirty || !r->marked || !r->current || !r->slice ||
+       !r->ends || !r->busy || !r->owner || !r->idle || !r->arena || evlist_init(&r->events, net->count + net->servers)) {
+        _release(r);
+        return -1;
+    }
+    for(i = 0; i < net->count; i++) {
+        s = &net->st[i];
+        if((r->live[i] = new_cqueue(s->mode, r->arena)) == NULL || cqueue_account(r->live[i], _nclock, &r->now) ||
+           simbusy_init(&r->busy[i], s->servers)) {
+            _release(r);
+            return -1;
+        }
+        //The station's first server ends up on top of its idle stack
+        for(k = 0; k < s->servers; k++) {
+            r->owner[s->first+k] = i;
+            r->idle[s->first+k]  = s->first + s->servers-1-k;
+        }
+        r->nidle[i]        = s->servers;
+        res->visits[i]     = 0;
+        res->utilized[i]   = 0;
+        tally_init(res->wait[i]);
+        tally_init(res->sojourn[i]);
+    }
+    tally_init(res->total);
+    res->analyzed = 0;
+
+    //Draws come in the same order for a seed, classes far down the stream
+    rng_seed(&r->random, (unsigned long)cfg->rseed, cfg->stream);
+    r->classes = r->random;
+    rng_skip(&r->classes, 1UL << 62);
+    expblock_init(&r->draws, &r->random);
+
+    //Every station fed from outside sees its first arrival at once
+    for(i = 0; i < net->count && cfg->customers > 0; i++)
+        if(net->st[i].lambda > 0)
+            evlist_push(&r->events, 0, ARRIVAL, i);
+
+    while(evlist_pop(&r->events, &e)) {
+        r->now = e.time;
+        switch(e.type) {
+            case ARRIVAL:
+                //Arrivals stop once enough customers came in, wherever
+                if(generated >= cfg->customers)
+                    break;
+                if((c = carena_get(r->arena)) == CID_NONE) {
+                    //Out of memory, abandon the run
+                    r->events.count = 0;
+                    status = -1;
+                    break;
+                }
+                r->arena->entered[c] = _nns(r->now);
+                _arrive(r, e.server, c);
+                if(++generated < cfg->customers) {
+                    t = dist_next(cfg->arrivals, &r->draws)/net->st[e.server].lambda;
+                    evlist_push(&r->events, r->now + t, ARRIVAL, e.server);
+                }
+                break;
+            case DEPARTURE:
+                g = e.server;
+                c = r->current[g];
+                _depart(r, g);
+                //The slice is over, back to the end of the line if owed more
+                if(r->arena->left[c] > 0)
+                    encqueue(r->live[r->owner[g]], c);
+                else
+                    _route(r, r->owner[g], c);
+                break;
+        }
+
+        //Stations the event touched get their servers handed out
+        while(r->ndirty > 0) {
+            i = r->dirty[--r->ndirty];
+            r->marked[i] = 0;
+            _serve(r, i);
+        }
+    }
+
+    //Work totals become utilization percentages
+    res->elapsed = r->now;
+    for(i = 0; i < net->count; i++) {
+        s = &net->st[i];
+        res->utilized[i] = (r->now > 0) ? 100*res->utilized[i]/(r->now*s->servers) : 0;
+        cqueue_length_stats(r->live[i], &res->qlen_avg[i], &t, NULL);
+    }
+    _release(r);
+    return status;
+}
+
+//Solves the traffic equations rate = lambda + P'rate by Gaussian
+//elimination, failing when customers have no way out
+int _solve(network* net) {
+    int     n = net->count, i, j, k, piv;
+    double* a = (double*)calloc((size_t)n*(n+1), sizeof(double));
+    double  f, t;
+    station* s;
+
+    if(a == NULL)
+        return -1;
+    //Row j: rate_j - sum_i P[i][j] rate_i = lambda_j
+    for(j = 0; j < n; j++) {
+        a[(size_t)j*(n+1) + j] += 1;
+        a[(size_t)j*(n+1) + n]  = net->st[j].lambda;
+    }
+    for(i = 0; i < n; i++) {
+        s = &net->st[i];
+        for(k = 0; k < s->routes; k++)
+            a[(size_t)s->to[k]*(n+1) + i] -= s->upto[k] - (k ? s->upto[k-1] : 0);
+    }
+    for(k = 0; k < n; k++) {
+        for(piv = k, i = k+1; i < n; i++)
+            if(fabs(a[(size_t)i*(n+1) + k]) > fabs(a[(size_t)piv*(n+1) + k]))
+                piv = i;
+        if(fabs(a[(size_t)piv*(n+1) + k]) < 1e-12) {
+            free(a);
+            return -1;
+        }
+        for(j = k; j <= n && piv != k; j++) {
+            t = a[(size_t)k*(n+1) + j];
+            a[(size_t)k*(n+1) + j]   = a[(size_t)piv*(n+1) + j];
+            a[(size_t)piv*(n+1) + j] = t;
+        }
+        for(i = k+1; i < n; i++) {
+            f = a[(size_t)i*(n+1) + k]/a[(size_t)k*(n+1) + k];
+            for(j = k; j <= n; j++)
+                a[(size_t)i*(n+1) + j] -= f*a[(size_t)k*(n+1) + j];
+        }
+    }
+    for(i = n-1; i >= 0; i--) {
+        for(t = a[(size_t)i*(n+1) + n], j = i+1; j < n; j++)
+            t -= a[(size_t)i*(n+1) + j]*net->st[j].rate;
+        net->st[i].rate = t/a[(size_t)i*(n+1) + i];
+    }
+    free(a);
+    //Nothing coming in from outside makes an empty network
+    for(i = 0, t = 0; i < n; i++)
+        t += net->st[i].lambda;
+    return (t > 0) ? 0 : -1;
+}
+
+double _nclock(void* now) {
+    return *(double*)now;
+}
+
+long _nns(double s) {
+    return (long)llround(s*1e9);
+}
+
+//A customer shows up at a station with a fresh job drawn for it
+void _arrive(netrun* r, int s, cid c) {
+    station* st = &r->net->st[s];
+    carena*  a  = r->arena;
+    a->born[c] = _nns(r->now);
+    a->job[c]  = dist_next(r->cfg->service, &r->draws)/st->mu;
+    a->left[c] = a->job[c];
+    a->prio[c] = (st->classes > 1) ? (int)(rng_uniform(&r->classes)*st->classes) : 0;
+    encqueue(r->live[s], c);
+    _touch(r, s);
+}
+
+//Routes are taken by chance, past the last one the customer leaves
+void _route(netrun* r, int s, cid c) {
+    station* st = &r->net->st[s];
+    double   u  = rng_uniform(&r->random);
+    int      k;
+    for(k = 0; k < st->routes && u >= st->upto[k]; k++);
+    if(k < st->routes) {
+        _arrive(r, st->to[k], c);
+        return;
+    }
+    r->res->analyzed++;
+    tally_add(r->res->total, (_nns(r->now) - r->arena->entered[c])/1e9);
+    carena_put(r->arena, c);
+}
+
+//Station needs serving before the next event
+void _touch(netrun* r, int s) {
+    if(r->marked[s])
+        return;
+    r->marked[s] = 1;
+    r->dirty[r->ndirty++] = s;
+}
+
+//Put a customer on a server for as much of what it is owed as the
+//station's quantum allows
+void _start(netrun* r, int g, cid c) {
+    int    s       = r->owner[g];
+    double quantum = r->net->st[s].quantum;
+    double left    = r->arena->left[c];
+    r->current[g] = c;
+    r->slice[g]   = (quantum > 0 && left > quantum) ? quantum : left;
+    r->ends[g]    = r->now + r->slice[g];
+    evlist_push(&r->events, r->ends[g], DEPARTURE, g);
+    if(r->live[s]->disc->rank)
+        simbusy_add(&r->busy[s], g - r->net->st[s].first,
+                    sim_key(r->live[s]->disc, r->arena, c, r->slice[g], r->ends[g]));
+}
+
+//Take the customer off a server once its slice is served, tallying the
+//visit if that was the last of its job. The server goes idle.
+void _depart(netrun* r, int g) {
+    carena*   a = r->arena;
+    cid       c = r->current[g];
+    int       s = r->owner[g];
+    double    t;
+    r->current[g] = CID_NONE;
+    simbusy_remove(&r->busy[s], g - r->net->st[s].first);
+    r->res->utilized[s] += r->slice[g];
+    r->idle[r->net->st[s].first + r->nidle[s]++] = g;
+    _touch(r, s);
+    a->left[c] = (r->slice[g] < a->left[c]) ? a->left[c] - r->slice[g] : 0;
+    if(a->left[c] > 0)
+        return;
+    //Waits shorter than the clock's nanosecond are none at all
+    t = (_nns(r->now) - a->born[c])/1e9;
+    r->res->visits[s]++;
+    tally_add(r->res->sojourn[s], t);
+    tally_add(r->res->wait[s], (t - a->job[c] < 1e-9) ? 0 : t - a->job[c]);
+}
+
+//Same as the single station engine: a waiting customer outranking the
+//worst running one takes its server, then idle servers take whoever is
+//waiting. A customer preempted right as its job runs out is done and
+//moves on like any other.
+void _serve(netrun* r, int s) {
+    station*      st   = &r->net->st[s];
+    cqueue*       live = r->live[s];
+    const cqdisc* disc = live->disc;
+    carena*       a    = r->arena;
+    cid           c;
+    double        rank;
+    int           i, g;
+
+    while(disc->rank && r->nidle[s] == 0 && (c = cqueue_peek(live)) != CID_NONE) {
+        i = sim_victim(&r->busy[s], disc, a, r->current + st->first, r->slice + st->first,
+                       r->ends + st->first, r->now, &rank);
+        if(i < 0 || disc->rank(a, c, a->left[c]) >= rank)
+            break;
+        g = st->first + i;
+        r->slice[g] -= r->ends[g] - r->now;
+        c = r->current[g];
+        evlist_cancel(&r->events, g);
+        _depart(r, g);
+        if(a->left[c] > 0)
+            encqueue(live, c);
+        else
+            _route(r, s, c);
+    }
+    while(r->nidle[s] > 0 && live->count > 0)
+        _start(r, r->idle[st->first + --r->nidle[s]], decqueue(live));
+}
+
+void _release(netrun* r) {
+    int i;
+    for(i = 0; r->live && i < r->net->count; i++)
+        if(r->live[i])
+            destroy_cqueue(r->live[i]);
+    for(i = 0; r->busy && i < r->net->count; i++)
+        simbusy_free(&r->busy[i]);
+    evlist_free(&r->events);
+    destroy_carena(r->arena);
+    free(r->live);
+    free(r->nidle);
+    free(r->dirty);
+    free(r->marked);
+    free(r->current);
+    free(r->slice);
+    free(r->ends);
+    free(r->owner);
+    free(r->busy);
+    free(r->idle);
+}
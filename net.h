@@ -0,0 +1,53 @@
+#ifndef NET_H_INCLUDED
+#define NET_H_INCLUDED
+
+#include "sim.h"
+
+//Most stations a network file can describe
+#define NET_STATIONS 1024
+
+//Structure for one station of a network: its own queue and servers, fed
+//from outside the network and by the routes of other stations
+typedef struct _station {
+    int              servers;         //Number of servers at the station
+    int              first;           //Index of the station's first server among every server
+    double           mu;              //Service rate of each server
+    double           lambda;          //Rate of arrivals from outside the network
+    double           rate;            //Rate of arrivals all told, from the traffic equations
+    enum   _cqmode   mode;            //Discipline of the station's queue
+    double           quantum;         //Longest stretch of service before going back in line (0 runs to the end)
+    int              classes;         //Priority classes customers are spread over (1 keeps all in class 0)
+    int              routes;          //Number of stations served customers can move on to
+    int*             to;              //Station each route leads to
+    double*          upto;            //Chance of taking a route or any before it, what is left leaves
+} station;
+
+//Structure for an open queueing network read from a file
+typedef struct _network {
+    char*            path;            //File the network was read from
+    int              count;           //Number of stations
+    int              servers;         //Number of servers over every station
+    struct _station* st;              //Stations, in the order the file gives them
+} network;
+
+//Structure for holding network simulation results
+typedef struct _netresult {
+    int              stations;        //Number of stations results are kept for
+    int              analyzed;        //Number of customers that left the network
+    double           elapsed;         //Seconds simulated
+    long*            visits;          //Visits completed at each station
+    double*          utilized;        //Utilization of each station, averaged over its servers (percent)
+    double*          qlen_avg;        //Average queue length at each station
+    tally**          wait;            //Distribution of waiting time at each station, per visit
+    tally**          sojourn;         //Distribution of time at each station, per visit
+    tally*           total;           //Distribution of time from entering the network to leaving it
+} netresult;
+
+network*   new_network(const char* path);
+void       destroy_network(network* net);
+int        network_overloaded(network* net);
+netresult* new_netresult(int stations);
+void       destroy_netresult(netresult* result);
+int        net_run(network* net, simconfig* config, netresult* result);
+
+#endif // NET_H_INCLUDED
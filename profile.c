@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+static int    _sinusoid(profile* p, double mean, double amplitude, double period);
+static int    _steps(profile* p, const char* path);
+static int    _grow(profile* p, int size);
+static double _expected(const profile* p, double t);
+
+//Specifications are either sin:mean:amplitude:period, a rate swinging
+//around its mean, or a file of 'duration rate' lines, one per step, with
+//the cycle as long as the steps put together. Lines starting with '#'
+//are comments. Returns NULL on a bad specification or file.
+profile* new_profile(const char* spec) {
+    double mean, amplitude, period;
+    char   tail;
+    int    i, bad;
+    profile* p;
+
+    if(spec == NULL || (p = (profile*)calloc(1, sizeof(profile))) == NULL)
+        return NULL;
+    if((p->spec = strdup(spec)) == NULL) {
+        free(p);
+        return NULL;
+    }
+    if(!strncmp(spec, "sin:", 4))
+        bad = sscanf(spec+4, "%lf:%lf:%lf%c", &mean, &amplitude, &period, &tail) != 3 ||
+              !(mean > 0) || amplitude < 0 || amplitude > mean || !(period > 0) ||
+              _sinusoid(p, mean, amplitude, period);
+    else
+        bad = _steps(p, spec);
+    if(bad) {
+        destroy_profile(p);
+        return NULL;
+    }
+    for(i = 0; i < p->steps; i++)
+        p->area[i] = (i ? p->area[i-1] : 0) + p->rate[i]*(p->until[i] - (i ? p->until[i-1] : 0));
+    p->period = p->until[p->steps-1];
+    p->mean   = p->area[p->steps-1]/p->period;
+    //A cycle without arrivals would never produce the next one
+    if(!(p->mean > 0)) {
+        destroy_profile(p);
+        return NULL;
+    }
+    return p;
+}
+
+void destroy_profile(profile* p) {
+    if(p == NULL)
+        return;
+    free(p->spec);
+    free(p->until);
+    free(p->rate);
+    free(p->area);
+    free(p);
+    return;
+}
+
+void profile_cursor(profcur* c) {
+    c->step  = 0;
+    c->cycle = 0;
+    c->base  = 0;
+    c->work  = 0;
+}
+
+//Mean arrival rate over one window of the cycle
+double profile_rate(const profile* p, int w) {
+    double width = p->period/PROFILE_WINDOWS;
+    return (_expected(p, (w+1)*width) - _expected(p, w*width))/width;
+}
+
+//Spread a queue length held from one time to another over the windows
+//it spans
+void profile_integrate(const profile* p, winstat* w, double from, double to, double level) {
+    double edge;
+    long   k;
+    while(from < to) {
+        k    = (long)floor(from*PROFILE_WINDOWS/p->period);
+        edge = (k+1)*p->period/PROFILE_WINDOWS;
+        edge = (edge < to) ? edge : to;
+        w[k % PROFILE_WINDOWS].area += level*(edge - from);
+        w[k % PROFILE_WINDOWS].span += edge - from;
+        //Rounding can leave from a hair short of the edge, move on anyway
+        from = (edge > from) ? edge : to;
+    }
+}
+
+//Each step gets the exact mean of the sinusoid over it, so the expected
+//arrivals agree with the curve at every step boundary
+int _sinusoid(profile* p, double mean, double amplitude, double period) {
+    double a, b;
+    int i;
+    if(_grow(p, PROFILE_STEPS))
+        return -1;
+    for(i = 0; i < PROFILE_STEPS; i++) {
+        a = 2*M_PI*i/PROFILE_STEPS;
+        b = 2*M_PI*(i+1)/PROFILE_STEPS;
+        p->until[i] = period*(i+1)/PROFILE_STEPS;
+        p->rate[i]  = mean + amplitude*(cos(a) - cos(b))/(b - a);
+    }
+    p->steps = PROFILE_STEPS;
+    return 0;
+}
+
+int _steps(profile* p, const char* path) {
+    FILE*  in;
+    char   line[256];
+    double duration, rate, end = 0;
+    int    size = 0;
+
+    if((in = fopen(path, "r")) == NULL)
+        return -1;
+    while(fgets(line, sizeof(line), in)) {
+        if(line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if(sscanf(line, "%lf %lf", &duration, &rate) != 2 || !(duration > 0) || rate < 0 ||
+           (p->steps == size && _grow(p, size = size ? 2*size : 64))) {
+            fclose(in);
+            return -1;
+        }
+        end += duration;
+        p->until[p->steps] = end;
+        p->rate[p->steps]  = rate;
+        p->steps++;
+    }
+    fclose(in);
+    return (p->steps > 0) ? 0 : -1;
+}
+
+int _grow(profile* p, int size) {
+    void* grown;
+    if((grown = realloc(p->until, size*sizeof(double))) == NULL)
+        return -1;
+    p->until = (double*)grown;
+    if((grown = realloc(p->rate, size*sizeof(double))) == NULL)
+        return -1;
+    p->rate = (double*)grown;
+    if((grown = realloc(p->area, size*sizeof(double))) == NULL)
+        return -1;
+    p->area = (double*)grown;
+    return 0;
+}
+
+//Expected arrivals from the start of the cycle to t within it
+double _expected(const profile* p, double t) {
+    int i;
+    for(i = 0; i < p->steps-1 && p->until[i] < t; i++);
+    return (i ? p->area[i-1] : 0) + p->rate[i]*(t - (i ? p->until[i-1] : 0));
+}
@@ -0,0 +1,75 @@
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#include <math.h>
+
+//Steps a sinusoid is tabulated in per period
+#define PROFILE_STEPS   240
+//Windows per cycle the statistics are broken down into
+#define PROFILE_WINDOWS 24
+
+//Structure for a time varying arrival rate, piecewise constant over a
+//cycle that repeats. Arrivals come from inverting the expected number of
+//arrivals, so a run draws no more variates than a constant rate does.
+//Built once and only read afterwards, so every thread can share one.
+typedef struct _profile {
+    char*            spec;            //Specification it was built from
+    int              steps;           //Number of constant steps in the cycle
+    double*          until;           //End of each step, from the start of the cycle
+    double*          rate;            //Arrival rate during each step
+    double*          area;            //Expected arrivals from the start of the cycle to the end of each step
+    double           period;          //Length of the cycle
+    double           mean;            //Mean arrival rate over the cycle
+} profile;
+
+//Structure for walking a profile one arrival at a time
+typedef struct _profcur {
+    int              step;            //Step the last arrival fell in
+    double           cycle;           //Start of the current cycle
+    double           base;            //Expected arrivals before the current cycle
+    double           work;            //Expected arrivals up to the last arrival
+} profcur;
+
+//Structure for the statistics of one window of the cycle, folded over
+//every cycle the run went through
+typedef struct _winstat {
+    long             arrived;         //Customers born in the window and served
+    double           wait;            //Total wait of those customers
+    double           area;            //Queue length integrated over the window
+    double           span;            //Seconds spent in the window
+} winstat;
+
+profile* new_profile(const char* spec);
+void     destroy_profile(profile* p);
+void     profile_cursor(profcur* c);
+double   profile_rate(const profile* p, int window);
+void     profile_integrate(const profile* p, winstat* w, double from, double to, double level);
+
+//Time of the next arrival, work expected arrivals past the last one.
+//Steps without arrivals are skipped over since they add no work.
+static inline double profile_next(const profile* p, profcur* c, double work) {
+    double start, done;
+    c->work += work;
+    while(c->work >= c->base + p->area[c->step]) {
+        if(++c->step == p->steps) {
+            c->step   = 0;
+            c->cycle += p->period;
+            c->base  += p->area[p->steps-1];
+        }
+    }
+    start = c->cycle + (c->step ? p->until[c->step-1] : 0);
+    done  = c->base  + (c->step ? p->area[c->step-1] : 0);
+    return start + (c->work - done)/p->rate[c->step];
+}
+
+//Window of the cycle a time falls in
+static inline int profile_window(const profile* p, double t) {
+    return (int)((long)floor(t*PROFILE_WINDOWS/p->period) % PROFILE_WINDOWS);
+}
+
+//Time the window after the one a time falls in starts
+static inline double profile_edge(const profile* p, double t) {
+    return (floor(t*PROFILE_WINDOWS/p->period) + 1)*p->period/PROFILE_WINDOWS;
+}
+
+#endif // PROFILE_H_INCLUDED
@@ -0,0 +1,71 @@
+#include <unistd.h>
+#include "replicate.h"
+
+static void* _worker(void* targ);
+static int   _replicate(void* arg, int rep, vsimctx* ctx, simresult* scratch);
+
+int online_cores(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+//Jobs share nothing but the counter handing them out. Each worker keeps
+//one engine context, and one scratch result when asked, for every job
+//it runs.
+int run_pool(pooljob run, void* arg, int jobs, int servers, int threads) {
+    pthread_t* tids;
+    workpool   pool;
+    int i, started;
+
+    if(threads > jobs) threads = jobs;
+    if(threads < 1)    threads = 1;
+    tids = (pthread_t*)malloc(threads*sizeof(pthread_t));
+    if(tids == NULL)
+        return -1;
+    pool.run     = run;
+    pool.arg     = arg;
+    pool.jobs    = jobs;
+    pool.servers = servers;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.failed, 0);
+
+    //Whatever threads fail to start, the ones that did pick up the slack
+    for(started = 0; started < threads; started++)
+        if(pthread_create(&tids[started], NULL, _worker, &pool))
+            break;
+    if(started == 0)
+        _worker(&pool);
+    for(i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    free(tids);
+    return atomic_load(&pool.failed) ? -1 : 0;
+}
+
+//Each replication runs on its own Philox stream so results are
+//independent samples
+int replicate(simconfig* cfg, simresult** results, int reps, int threads) {
+    repwork work;
+    work.config  = cfg;
+    work.results = results;
+    return run_pool(_replicate, &work, reps, 0, threads);
+}
+
+void* _worker(void* targ) {
+    workpool*  pool = (workpool*)targ;
+    vsimctx*   ctx  = new_vsimctx();
+    simresult* res  = (pool->servers > 0) ? new_simresult(pool->servers) : NULL;
+    int job;
+    while((job = atomic_fetch_add(&pool->next, 1)) < pool->jobs)
+        if(ctx == NULL || (pool->servers > 0 && res == NULL) || pool->run(pool->arg, job, ctx, res))
+            atomic_fetch_add(&pool->failed, 1);
+    destroy_simresult(res);
+    destroy_vsimctx(ctx);
+    return NULL;
+}
+
+int _replicate(void* arg, int rep, vsimctx* ctx, simresult* scratch) {
+    repwork*  work = (repwork*)arg;
+    simconfig cfg  = *work->config;
+    cfg.stream = rep + 1;
+    return vsim_run_in(ctx, &cfg, work->results[rep]);
+}
@@ -0,0 +1,33 @@
+#ifndef REPLICATE_H_INCLUDED
+#define REPLICATE_H_INCLUDED
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "sim.h"
+#include "vsim.h"
+
+//A job a pool worker runs on its own engine context and scratch result,
+//nonzero when it failed
+typedef int (*pooljob)(void* arg, int job, vsimctx* ctx, simresult* scratch);
+
+//Structure shared by pool worker threads
+typedef struct _workpool {
+    pooljob          run;             //Runs one job
+    void*            arg;             //Handed to every job
+    int              jobs;            //Number of jobs
+    int              servers;         //Servers each worker's scratch result is sized for (0 for none)
+    atomic_int       next;            //Next job to hand out
+    atomic_int       failed;          //Number of jobs that failed
+} workpool;
+
+//Structure for what every replication shares
+typedef struct _repwork {
+    simconfig*       config;          //Reference to configuration every replication runs
+    simresult**      results;         //Reference to one result per replication
+} repwork;
+
+int  run_pool(pooljob run, void* arg, int jobs, int servers, int threads);
+int  replicate(simconfig* config, simresult** results, int reps, int threads);
+int  online_cores(void);
+
+#endif // REPLICATE_H_INCLUDED
@@ -0,0 +1,224 @@
+#include <math.h>
+#include "report.h"
+#include "steady.h"
+#include "trace.h"
+
+static void   _print_interval(FILE* out, const char* name, double* samples, int n);
+static void   _print_tally(FILE* out, const char* name, tally* t);
+static void   _print_string(FILE* out, const char* name, const char* s);
+static void   _print_text(FILE* out, const char* s);
+static const char* _mode_label(cqmode mode, double quantum, int classes, char* buf, int size);
+
+const char* cqmode_name(cqmode m) {
+    const cqdisc* d = cqmode_disc(m);
+    return d ? d->name : "unknown";
+}
+
+//One JSON object on one line, so batch runs can be collected with cat
+void print_report(FILE* out, const char* engine, simconfig* cfg, simresult* res) {
+    winstat* w;
+    char label[64];
+    int i, n;
+    fprintf(out, "{\"engine\":");
+    _print_text(out, engine);
+    _print_string(out, "mode", _mode_label(cfg->mode, cfg->quantum, cfg->classes, label, sizeof(label)));
+    fprintf(out, ",\"lambda\":%.17g,\"mu\":%.17g,\"servers\":%d,\"customers\":%d,\"seed\":%.0lf",
+            cfg->lambda, cfg->mu, cfg->servers, cfg->customers, cfg->rseed);
+    //A replayed trace stands in for both distributions
+    if(cfg->replay) {
+        fprintf(out, ",\"arrivals\":\"trace\",\"service\":\"trace\"");
+        _print_string(out, "trace", cfg->replay->path);
+    } else {
+        _print_string(out, "arrivals", cfg->arrivals ? cfg->arrivals->spec : "exp");
+        _print_string(out, "service", cfg->service ? cfg->service->spec : "exp");
+    }
+    fprintf(out, ",\"elapsed\":%.9g,\"analyzed\":%d", res->elapsed, res->analyzed);
+    fprintf(out, ",\"utilization\":[");
+    for(i = 0; i < res->servers; i++)
+        fprintf(out, "%s%.6g", i ? "," : "", res->utilized[i]);
+    fprintf(out, "],\"served\":[");
+    for(i = 0; i < res->servers; i++)
+        fprintf(out, "%s%d", i ? "," : "", res->served[i]);
+    fprintf(out, "],\"queue\":{\"mean\":%.9g,\"sigma\":%.9g,\"share\":[", res->qlen_avg, res->qlen_sigma);
+    //Lengths past the longest one seen are left out
+    for(n = CQ_LENGTHS; n > 1 && res->qlen_share[n-1] <= 0; n--);
+    for(i = 0; i < n; i++)
+        fprintf(out, "%s%.6g", i ? "," : "", res->qlen_share[i]);
+    fprintf(out, "]}");
+    _print_tally(out, "wait", res->wait);
+    _print_tally(out, "sojourn", res->sojourn);
+    //Only wall clock runs have timers that can be late
+    if(res->arrive_slack->count > 0)
+        _print_tally(out, "arrive_slack", res->arrive_slack);
+    if(res->finish_slack->count > 0)
+        _print_tally(out, "finish_slack", res->finish_slack);
+    //Profiled runs break the cycle down into windows
+    if(cfg->profile) {
+        fprintf(out, ",\"profile\":{\"spec\":");
+        _print_text(out, cfg->profile->spec);
+        fprintf(out, ",\"period\":%.9g,\"windows\":[", cfg->profile->period);
+        for(i = 0; i < PROFILE_WINDOWS; i++) {
+            w = &res->windows[i];
+            fprintf(out, "%s{\"start\":%.9g,\"rate\":%.9g,\"arrived\":%ld,\"wait\":%.9g,\"queue\":%.9g}",
+                    i ? "," : "", i*cfg->profile->period/PROFILE_WINDOWS, profile_rate(cfg->profile, i),
+                    w->arrived, w->arrived ? w->wait/w->arrived : 0, w->span > 0 ? w->area/w->span : 0);
+        }
+        fprintf(out, "]}");
+    }
+    //Adaptive runs estimate the steady state mean wait past the warm-up
+    if(cfg->precision > 0)
+        fprintf(out, ",\"steady\":{\"target\":%.9g,\"converged\":%d,\"warmup\":%ld,\"wait_mean\":%.9g,\"ci95\":%.9g}",
+                cfg->precision, res->converged, res->warmup, res->wait_steady, res->wait_ci95);
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+//Means of the per-replication means with 95% confidence half widths
+void print_replications(FILE* out, simconfig* cfg, simresult** res, int reps) {
+    double* samples = (double*)malloc(3*reps*sizeof(double));
+    tally*  wait    = new_tally();
+    tally*  sojourn = new_tally();
+    char    label[64];
+    double  u;
+    int i, j;
+    if(!samples || !wait || !sojourn) {
+        free(samples);
+        destroy_tally(wait);
+        destroy_tally(sojourn);
+        return;
+    }
+    for(i = 0; i < reps; i++) {
+        for(u = 0, j = 0; j < res[i]->servers; j++)
+            u += res[i]->utilized[j];
+        samples[i]        = res[i]->wait_avg;
+        samples[reps+i]   = res[i]->qlen_avg;
+        samples[2*reps+i] = u/res[i]->servers;
+        tally_merge(wait, res[i]->wait);
+        tally_merge(sojourn, res[i]->sojourn);
+    }
+    fprintf(out, "{\"engine\":\"virtual\"");
+    _print_string(out, "mode", _mode_label(cfg->mode, cfg->quantum, cfg->classes, label, sizeof(label)));
+    fprintf(out, ",\"lambda\":%.17g,\"mu\":%.17g,\"servers\":%d,\"customers\":%d,\"seed\":%.0lf",
+            cfg->lambda, cfg->mu, cfg->servers, cfg->customers, cfg->rseed);
+    _print_string(out, "arrivals", cfg->arrivals ? cfg->arrivals->spec : "exp");
+    _print_string(out, "service", cfg->service ? cfg->service->spec : "exp");
+    fprintf(out, ",\"replications\":%d", reps);
+    _print_interval(out, "wait", samples, reps);
+    _print_interval(out, "queue", samples+reps, reps);
+    _print_interval(out, "utilization", samples+2*reps, reps);
+    //Percentiles come from every customer of every replication pooled
+    _print_tally(out, "wait_pooled", wait);
+    _print_tally(out, "sojourn_pooled", sojourn);
+    fprintf(out, "}\n");
+    fflush(out);
+    free(samples);
+    destroy_tally(wait);
+    destroy_tally(sojourn);
+}
+
+//One JSON object for a network run, end-to-end statistics first and then
+//every station with the rate the traffic equations expect there
+void print_network(FILE* out, simconfig* cfg, network* net, netresult* res) {
+    station* s;
+    char   label[64];
+    long   visits = 0;
+    int i;
+    for(i = 0; i < net->count; i++)
+        visits += res->visits[i];
+    fprintf(out, "{\"engine\":\"network\"");
+    _print_string(out, "network", net->path);
+    fprintf(out, ",\"stations\":%d,\"customers\":%d,\"seed\":%.0lf", net->count, cfg->customers, cfg->rseed);
+    _print_string(out, "arrivals", cfg->arrivals ? cfg->arrivals->spec : "exp");
+    _print_string(out, "service", cfg->service ? cfg->service->spec : "exp");
+    fprintf(out, ",\"elapsed\":%.9g,\"analyzed\":%d,\"visits\":%.9g", res->elapsed, res->analyzed,
+            res->analyzed ? (double)visits/res->analyzed : 0);
+    _print_tally(out, "sojourn", res->total);
+    fprintf(out, ",\"station\":[");
+    for(i = 0; i < net->count; i++) {
+        s = &net->st[i];
+        fprintf(out, "%s{\"servers\":%d,\"mu\":%.17g", i ? "," : "", s->servers, s->mu);
+        _print_string(out, "mode", _mode_label(s->mode, s->quantum, s->classes, label, sizeof(label)));
+        fprintf(out, ",\"lambda\":%.17g,\"rate\":%.9g,\"rho\":%.9g", s->lambda, s->rate, s->rate/(s->servers*s->mu));
+        fprintf(out, ",\"visits\":%ld,\"utilization\":%.6g,\"queue_mean\":%.9g",
+                res->visits[i], res->utilized[i], res->qlen_avg[i]);
+        _print_tally(out, "wait", res->wait[i]);
+        _print_tally(out, "sojourn", res->sojourn[i]);
+        fprintf(out, "}");
+    }
+    fprintf(out, "]}\n");
+    fflush(out);
+}
+
+//One CSV table for a whole sweep, a header line and a row per point
+void print_sweep(FILE* out, sweeprow* rows, int n) {
+    sweeprow* r;
+    char   label[64];
+    double rho;
+    int i;
+    fprintf(out, "lambda,mu,servers,mode,rho,stable,customers,analyzed,elapsed,utilization,"
+                 "queue_mean,queue_sigma,wait_mean,wait_sigma,wait_p50,wait_p90,wait_p99,wait_p999,"
+                 "sojourn_mean,sojourn_p99,warmup,wait_steady,wait_ci95\n");
+    for(i = 0; i < n; i++) {
+        r   = &rows[i];
+        rho = r->config.lambda/(r->config.mu*r->config.servers);
+        fprintf(out, "%.17g,%.17g,%d,%s,%.9g,%d,%d,%d,%.9g,%.9g",
+                r->config.lambda, r->config.mu, r->config.servers,
+                _mode_label(r->config.mode, r->config.quantum, r->config.classes, label, sizeof(label)),
+                rho, rho < 1, r->config.customers, r->analyzed, r->elapsed, r->utilized);
+        fprintf(out, ",%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g",
+                r->qlen_avg, r->qlen_sigma, r->wait_avg, r->wait_sigma, r->wait_pct[0],
+                r->wait_pct[1], r->wait_pct[2], r->wait_pct[3], r->sojourn_avg, r->sojourn_p99);
+        fprintf(out, ",%ld,%.9g,%.9g\n", r->warmup, r->wait_steady, r->wait_ci95);
+    }
+    fflush(out);
+}
+
+void _print_interval(FILE* out, const char* name, double* x, int n) {
+    double sum = 0, ssq = 0, mean, half = 0;
+    int i;
+    for(i = 0; i < n; i++)
+        sum += x[i];
+    mean = sum/n;
+    for(i = 0; i < n; i++)
+        ssq += (x[i]-mean)*(x[i]-mean);
+    if(n > 1)
+        half = student_t95(n-1)*sqrt(ssq/(n-1))/sqrt(n);
+    fprintf(out, ",\"%s\":{\"mean\":%.9g,\"ci95\":%.9g}", name, mean, half);
+}
+
+void _print_tally(FILE* out, const char* name, tally* t) {
+    fprintf(out, ",\"%s\":{\"mean\":%.9g,\"sigma\":%.9g", name, tally_mean(t), tally_sigma(t));
+    fprintf(out, ",\"p50\":%.9g,\"p90\":%.9g,\"p99\":%.9g,\"p999\":%.9g}",
+            tally_quantile(t, 0.5), tally_quantile(t, 0.9), tally_quantile(t, 0.99), tally_quantile(t, 0.999));
+}
+
+void _print_string(FILE* out, const char* name, const char* s) {
+    fprintf(out, ",\"%s\":", name);
+    _print_text(out, s);
+}
+
+//Every string goes out through here, paths and specifications can hold
+//quotes, backslashes and control characters JSON needs escaped
+void _print_text(FILE* out, const char* s) {
+    fputc('"', out);
+    for(; *s != '\0'; s++) {
+        if(*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+//The mode as it is given on the command line, with its argument
+const char* _mode_label(cqmode m, double quantum, int classes, char* buf, int size) {
+    if(m == RR)
+        snprintf(buf, size, "%s:%.9g", cqmode_name(m), quantum);
+    else if(m == PRIO)
+        snprintf(buf, size, "%s:%d", cqmode_name(m), classes);
+    else
+        snprintf(buf, size, "%s", cqmode_name(m));
+    return buf;
+}
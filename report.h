@@ -0,0 +1,15 @@
+#ifndef REPORT_H_INCLUDED
+#define REPORT_H_INCLUDED
+
+#include <stdio.h>
+#include "sim.h"
+#include "sweep.h"
+#include "net.h"
+
+const char* cqmode_name(cqmode mode);
+void        print_report(FILE* out, const char* engine, simconfig* config, simresult* result);
+void        print_replications(FILE* out, simconfig* config, simresult** results, int reps);
+void        print_sweep(FILE* out, sweeprow* rows, int count);
+void        print_network(FILE* out, simconfig* config, network* net, netresult* result);
+
+#endif // REPORT_H_INCLUDED
@@ -0,0 +1,296 @@
+#include "rng.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//Philox4x32 round multipliers and Weyl key increments
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+//Coefficients of the log(1+f) remainder from fdlibm's __ieee754_log, the
+//approximation is good to about one ulp across (0,1]
+#define LG1 6.666666666666735130e-01
+#define LG2 3.999999999940941908e-01
+#define LG3 2.857142874366239149e-01
+#define LG4 2.222219843214978396e-01
+#define LG5 1.818357216161805012e-01
+#define LG6 1.531383769920937332e-01
+#define LG7 1.479819860511658591e-01
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define SQRT2  1.41421356237309514547
+
+static double _log_poly(double x);
+static void   _fill_scalar(rng* r, double scale, double* out, int n);
+#if defined(__x86_64__)
+static int    _fill_avx2(rng* r, double scale, double* out, int n);
+static int    _fill_avx512(rng* r, double scale, double* out, int n);
+#endif
+
+void rng_seed(rng* r, unsigned long seed, unsigned long stream) {
+    r->key[0] = (unsigned int)seed;
+    r->key[1] = (unsigned int)(seed >> 32);
+    r->ctr[0] = 0;
+    r->ctr[1] = 0;
+    r->ctr[2] = (unsigned int)stream;
+    r->ctr[3] = (unsigned int)(stream >> 32);
+    r->used   = 4;
+}
+
+//Jump ahead by whole blocks of four words, a stream holds 2^64 blocks
+void rng_skip(rng* r, unsigned long n) {
+    unsigned long c = ((unsigned long)r->ctr[1] << 32 | r->ctr[0]) + n;
+    r->ctr[0] = (unsigned int)c;
+    r->ctr[1] = (unsigned int)(c >> 32);
+    r->used   = 4;
+}
+
+void rng_block(const unsigned int ctr[4], const unsigned int key[2], unsigned int out[4]) {
+    unsigned int  c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    unsigned int  k0 = key[0], k1 = key[1];
+    unsigned long p0, p1;
+    int i;
+    for(i = 0; i < PHILOX_ROUNDS; i++) {
+        p0 = (unsigned long)PHILOX_M0 * c0;
+        p1 = (unsigned long)PHILOX_M1 * c2;
+        c0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+        c2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (unsigned int)p1;
+        c3 = (unsigned int)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+rngsimd rng_simd_level(void) {
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("avx512f"))
+        return RNG_AVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return RNG_AVX2;
+#endif
+    return RNG_SCALAR;
+}
+
+void rng_exp_fill(rng* r, double rate, double* out, int n) {
+    rng_exp_fill_with(r, rate, out, n, rng_simd_level());
+}
+
+//Fills out with the same variates rng_exp() would draw one at a time,
+//up to the log approximation. Vector kernels work on whole groups of
+//blocks, any partly used block and the tail go through the scalar path.
+void rng_exp_fill_with(rng* r, double rate, double* out, int n, rngsimd level) {
+    double scale = -1.0/rate;
+    int done = 0;
+    while(done < n && r->used != 4) {
+        out[done++] = scale*_log_poly(1.0-rng_uniform(r));
+    }
+#if defined(__x86_64__)
+    if(level == RNG_AVX512 && (r->used & 1) == 0)
+        done += _fill_avx512(r, scale, out+done, n-done);
+    if(level >= RNG_AVX2 && (r->used & 1) == 0)
+        done += _fill_avx2(r, scale, out+done, n-done);
+#endif
+    _fill_scalar(r, scale, out+done, n-done);
+}
+
+void expblock_init(expblock* b, rng* r) {
+    b->gen  = r;
+    b->next = EXPBLOCK;
+}
+
+double _log_poly(double x) {
+    union {unsigned long u; double d;} v;
+    double e, m, f, s, z, w, R, hfsq;
+    v.d = x;
+    e   = (double)((long)(v.u >> 52) - 1023);
+    v.u = (v.u & 0x000FFFFFFFFFFFFFUL) | 0x3FF0000000000000UL;
+    m   = v.d;
+    //Keep the mantissa within [sqrt(2)/2, sqrt(2)) so f stays small
+    if(m > SQRT2) {
+        m *= 0.5;
+        e += 1;
+    }
+    f    = m - 1.0;
+    s    = f/(2.0+f);
+    z    = s*s;
+    w    = z*z;
+    R    = w*(LG2+w*(LG4+w*LG6)) + z*(LG1+w*(LG3+w*(LG5+w*LG7)));
+    hfsq = 0.5*f*f;
+    return e*LN2_HI - ((hfsq - (s*(hfsq+R) + e*LN2_LO)) - f);
+}
+
+void _fill_scalar(rng* r, double scale, double* out, int n) {
+    int i;
+    for(i = 0; i < n; i++)
+        out[i] = scale*_log_poly(1.0-rng_uniform(r));
+}
+
+#if defined(__x86_64__)
+//Four Philox blocks side by side, one per 64 bit lane, eight variates
+//out per pass in the same order the scalar path hands them out
+__attribute__((target("avx2")))
+int _fill_avx2(rng* r, double scale, double* out, int n) {
+    const __m256i lo32  = _mm256_set1_epi64x(0xFFFFFFFFL);
+    const __m256i m0    = _mm256_set1_epi64x(PHILOX_M0);
+    const __m256i m1    = _mm256_set1_epi64x(PHILOX_M1);
+    const __m256i mant  = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFL);
+    const __m256i one   = _mm256_set1_epi64x(0x3FF0000000000000L);
+    const __m256i magic = _mm256_set1_epi64x(0x4330000000000000L);
+    const __m256d bias  = _mm256_set1_pd(4503599627370496.0 + 1023.0);
+    const __m256d two   = _mm256_set1_pd(2.0);
+    const __m256d half  = _mm256_set1_pd(0.5);
+    const __m256d onepd = _mm256_set1_pd(1.0);
+    const __m256d sqrt2 = _mm256_set1_pd(SQRT2);
+    const __m256d vscl  = _mm256_set1_pd(scale);
+    __m256i c0, c1, c2, c3, k0, k1, p0, p1, w[2], bits, ev;
+    __m256d x, e, m, f, s, z, q, R, t1, t2, hfsq, lg[2], big;
+    unsigned long base = (unsigned long)r->ctr[1] << 32 | r->ctr[0];
+    int i, j, done = 0;
+
+    for(; done+8 <= n; done += 8, base += 4) {
+        c0 = _mm256_set_epi64x((unsigned int)(base+3), (unsigned int)(base+2),
+                               (unsigned int)(base+1), (unsigned int)(base));
+        c1 = _mm256_set_epi64x((base+3) >> 32, (base+2) >> 32, (base+1) >> 32, base >> 32);
+        c2 = _mm256_set1_epi64x(r->ctr[2]);
+        c3 = _mm256_set1_epi64x(r->ctr[3]);
+        k0 = _mm256_set1_epi64x(r->key[0]);
+        k1 = _mm256_set1_epi64x(r->key[1]);
+        for(i = 0; i < PHILOX_ROUNDS; i++) {
+            p0 = _mm256_mul_epu32(m0, c0);
+            p1 = _mm256_mul_epu32(m1, c2);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), c1), k0);
+            c2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), c3), k1);
+            c1 = _mm256_and_si256(p1, lo32);
+            c3 = _mm256_and_si256(p0, lo32);
+            k0 = _mm256_and_si256(_mm256_add_epi64(k0, _mm256_set1_epi64x(PHILOX_W0)), lo32);
+            k1 = _mm256_and_si256(_mm256_add_epi64(k1, _mm256_set1_epi64x(PHILOX_W1)), lo32);
+        }
+        //Words (c0,c1) make the first variate of each block, (c2,c3) the second
+        w[0] = _mm256_xor_si256(_mm256_slli_epi64(c0, 20), _mm256_srli_epi64(c1, 12));
+        w[1] = _mm256_xor_si256(_mm256_slli_epi64(c2, 20), _mm256_srli_epi64(c3, 12));
+        for(j = 0; j < 2; j++) {
+            //1-u lands in (0,1]
+            x    = _mm256_sub_pd(two, _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(w[j], mant), one)));
+            bits = _mm256_castpd_si256(x);
+            ev   = _mm256_srli_epi64(bits, 52);
+            m    = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mant), one));
+            big  = _mm256_cmp_pd(m, sqrt2, _CMP_GT_OQ);
+            m    = _mm256_blendv_pd(m, _mm256_mul_pd(m, half), big);
+            ev   = _mm256_sub_epi64(ev, _mm256_castpd_si256(big));
+            e    = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(ev, magic)), bias);
+            f    = _mm256_sub_pd(m, onepd);
+            s    = _mm256_div_pd(f, _mm256_add_pd(two, f));
+            z    = _mm256_mul_pd(s, s);
+            q    = _mm256_mul_pd(z, z);
+            t1   = _mm256_add_pd(_mm256_set1_pd(LG4), _mm256_mul_pd(q, _mm256_set1_pd(LG6)));
+            t1   = _mm256_mul_pd(q, _mm256_add_pd(_mm256_set1_pd(LG2), _mm256_mul_pd(q, t1)));
+            t2   = _mm256_add_pd(_mm256_set1_pd(LG5), _mm256_mul_pd(q, _mm256_set1_pd(LG7)));
+            t2   = _mm256_add_pd(_mm256_set1_pd(LG3), _mm256_mul_pd(q, t2));
+            t2   = _mm256_mul_pd(z, _mm256_add_pd(_mm256_set1_pd(LG1), _mm256_mul_pd(q, t2)));
+            R    = _mm256_add_pd(t1, t2);
+            hfsq = _mm256_mul_pd(half, _mm256_mul_pd(f, f));
+            t1   = _mm256_add_pd(_mm256_mul_pd(s, _mm256_add_pd(hfsq, R)), _mm256_mul_pd(e, _mm256_set1_pd(LN2_LO)));
+            t1   = _mm256_sub_pd(_mm256_sub_pd(hfsq, t1), f);
+            lg[j] = _mm256_sub_pd(_mm256_mul_pd(e, _mm256_set1_pd(LN2_HI)), t1);
+            lg[j] = _mm256_mul_pd(lg[j], vscl);
+        }
+        //Interleave back into block order a0 b0 a1 b1 ...
+        x = _mm256_unpacklo_pd(lg[0], lg[1]);
+        m = _mm256_unpackhi_pd(lg[0], lg[1]);
+        _mm256_storeu_pd(out+done,   _mm256_permute2f128_pd(x, m, 0x20));
+        _mm256_storeu_pd(out+done+4, _mm256_permute2f128_pd(x, m, 0x31));
+    }
+    r->ctr[0] = (unsigned int)base;
+    r->ctr[1] = (unsigned int)(base >> 32);
+    //Unoptimized builds don't get vzeroupper for free, and a dirty upper
+    //half makes every following SSE instruction (libm's log) pay for it
+    _mm256_zeroupper();
+    return done;
+}
+
+//Same kernel eight blocks wide
+__attribute__((target("avx512f")))
+int _fill_avx512(rng* r, double scale, double* out, int n) {
+    const __m512i lo32  = _mm512_set1_epi64(0xFFFFFFFFL);
+    const __m512i m0    = _mm512_set1_epi64(PHILOX_M0);
+    const __m512i m1    = _mm512_set1_epi64(PHILOX_M1);
+    const __m512i mant  = _mm512_set1_epi64(0x000FFFFFFFFFFFFFL);
+    const __m512i one   = _mm512_set1_epi64(0x3FF0000000000000L);
+    const __m512i magic = _mm512_set1_epi64(0x4330000000000000L);
+    const __m512i lane  = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i ilo   = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+    const __m512i ihi   = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+    const __m512d bias  = _mm512_set1_pd(4503599627370496.0 + 1023.0);
+    const __m512d two   = _mm512_set1_pd(2.0);
+    const __m512d half  = _mm512_set1_pd(0.5);
+    const __m512d onepd = _mm512_set1_pd(1.0);
+    const __m512d sqrt2 = _mm512_set1_pd(SQRT2);
+    const __m512d vscl  = _mm512_set1_pd(scale);
+    __m512i c0, c1, c2, c3, k0, k1, p0, p1, w[2], bits, ev, ctr;
+    __m512d x, e, m, f, s, z, q, R, t1, t2, hfsq, lg[2];
+    __mmask8 big;
+    unsigned long base = (unsigned long)r->ctr[1] << 32 | r->ctr[0];
+    int i, j, done = 0;
+
+    for(; done+16 <= n; done += 16, base += 8) {
+        ctr = _mm512_add_epi64(_mm512_set1_epi64(base), lane);
+        c0  = _mm512_and_si512(ctr, lo32);
+        c1  = _mm512_srli_epi64(ctr, 32);
+        c2  = _mm512_set1_epi64(r->ctr[2]);
+        c3  = _mm512_set1_epi64(r->ctr[3]);
+        k0  = _mm512_set1_epi64(r->key[0]);
+        k1  = _mm512_set1_epi64(r->key[1]);
+        for(i = 0; i < PHILOX_ROUNDS; i++) {
+            p0 = _mm512_mul_epu32(m0, c0);
+            p1 = _mm512_mul_epu32(m1, c2);
+            c0 = _mm512_xor_si512(_mm512_xor_si512(_mm512_srli_epi64(p1, 32), c1), k0);
+            c2 = _mm512_xor_si512(_mm512_xor_si512(_mm512_srli_epi64(p0, 32), c3), k1);
+            c1 = _mm512_and_si512(p1, lo32);
+            c3 = _mm512_and_si512(p0, lo32);
+            k0 = _mm512_and_si512(_mm512_add_epi64(k0, _mm512_set1_epi64(PHILOX_W0)), lo32);
+            k1 = _mm512_and_si512(_mm512_add_epi64(k1, _mm512_set1_epi64(PHILOX_W1)), lo32);
+        }
+        w[0] = _mm512_xor_si512(_mm512_slli_epi64(c0, 20), _mm512_srli_epi64(c1, 12));
+        w[1] = _mm512_xor_si512(_mm512_slli_epi64(c2, 20), _mm512_srli_epi64(c3, 12));
+        for(j = 0; j < 2; j++) {
+            x    = _mm512_sub_pd(two, _mm512_castsi512_pd(_mm512_or_si512(_mm512_and_si512(w[j], mant), one)));
+            bits = _mm512_castpd_si512(x);
+            ev   = _mm512_srli_epi64(bits, 52);
+            m    = _mm512_castsi512_pd(_mm512_or_si512(_mm512_and_si512(bits, mant), one));
+            big  = _mm512_cmp_pd_mask(m, sqrt2, _CMP_GT_OQ);
+            m    = _mm512_mask_mul_pd(m, big, m, half);
+            ev   = _mm512_mask_add_epi64(ev, big, ev, _mm512_set1_epi64(1));
+            e    = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(ev, magic)), bias);
+            f    = _mm512_sub_pd(m, onepd);
+            s    = _mm512_div_pd(f, _mm512_add_pd(two, f));
+            z    = _mm512_mul_pd(s, s);
+            q    = _mm512_mul_pd(z, z);
+            t1   = _mm512_add_pd(_mm512_set1_pd(LG4), _mm512_mul_pd(q, _mm512_set1_pd(LG6)));
+            t1   = _mm512_mul_pd(q, _mm512_add_pd(_mm512_set1_pd(LG2), _mm512_mul_pd(q, t1)));
+            t2   = _mm512_add_pd(_mm512_set1_pd(LG5), _mm512_mul_pd(q, _mm512_set1_pd(LG7)));
+            t2   = _mm512_add_pd(_mm512_set1_pd(LG3), _mm512_mul_pd(q, t2));
+            t2   = _mm512_mul_pd(z, _mm512_add_pd(_mm512_set1_pd(LG1), _mm512_mul_pd(q, t2)));
+            R    = _mm512_add_pd(t1, t2);
+            hfsq = _mm512_mul_pd(half, _mm512_mul_pd(f, f));
+            t1   = _mm512_add_pd(_mm512_mul_pd(s, _mm512_add_pd(hfsq, R)), _mm512_mul_pd(e, _mm512_set1_pd(LN2_LO)));
+            t1   = _mm512_sub_pd(_mm512_sub_pd(hfsq, t1), f);
+            lg[j] = _mm512_sub_pd(_mm512_mul_pd(e, _mm512_set1_pd(LN2_HI)), t1);
+            lg[j] = _mm512_mul_pd(lg[j], vscl);
+        }
+        _mm512_storeu_pd(out+done,   _mm512_permutex2var_pd(lg[0], ilo, lg[1]));
+        _mm512_storeu_pd(out+done+8, _mm512_permutex2var_pd(lg[0], ihi, lg[1]));
+    }
+    r->ctr[0] = (unsigned int)base;
+    r->ctr[1] = (unsigned int)(base >> 32);
+    _mm256_zeroupper();
+    return done;
+}
+#endif
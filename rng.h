@@ -0,0 +1,76 @@
+#ifndef RNG_H_INCLUDED
+#define RNG_H_INCLUDED
+
+#include <math.h>
+
+//Variates held by an exponential block
+#define EXPBLOCK 256
+
+//Instruction sets the batch kernels can run on
+enum _rngsimd {RNG_SCALAR = 0, RNG_AVX2 = 1, RNG_AVX512 = 2};
+
+//Misc Typedefs
+typedef enum   _rngsimd rngsimd;
+
+//Structure for a Philox4x32-10 counter-based generator. Every 128 bit
+//counter value maps to four fresh 32 bit words under the key, so streams
+//are picked by key and counter and jumping ahead is just counter math.
+//Each thread owns its own rng, nothing is shared.
+typedef struct _rng {
+    unsigned int     key[2];          //Key, taken from the seed
+    unsigned int     ctr[4];          //Counter, low words count blocks and high words hold the stream
+    unsigned int     buf[4];          //Output of the last block
+    int              used;            //Words of buf already handed out
+} rng;
+
+//Structure for handing out unit exponential variates generated in blocks
+typedef struct _expblock {
+    struct _rng*     gen;             //Reference to the generator the block is filled from
+    int              next;            //Next variate to hand out
+    double           vals[EXPBLOCK];  //Unit rate variates, scaled by the caller
+} expblock;
+
+void    rng_seed(rng* r, unsigned long seed, unsigned long stream);
+void    rng_skip(rng* r, unsigned long blocks);
+void    rng_block(const unsigned int ctr[4], const unsigned int key[2], unsigned int out[4]);
+void    rng_exp_fill(rng* r, double rate, double* out, int n);
+void    rng_exp_fill_with(rng* r, double rate, double* out, int n, rngsimd level);
+rngsimd rng_simd_level(void);
+void    expblock_init(expblock* b, rng* r);
+
+//Next 32 random bits
+static inline unsigned int rng_next(rng* r) {
+    if(r->used == 4) {
+        rng_block(r->ctr, r->key, r->buf);
+        //Carry through the two block counter words
+        if(++r->ctr[0] == 0)
+            r->ctr[1]++;
+        r->used = 0;
+    }
+    return r->buf[r->used++];
+}
+
+//Uniform double in [0,1) with 52 random bits, built straight into the
+//mantissa so the vector kernels can produce the identical value
+static inline double rng_uniform(rng* r) {
+    union {unsigned long u; double d;} v;
+    unsigned long hi = rng_next(r), lo = rng_next(r);
+    v.u = 0x3FF0000000000000UL | (((hi << 20) ^ (lo >> 12)) & 0x000FFFFFFFFFFFFFUL);
+    return v.d - 1.0;
+}
+
+//Exponential variate with the given rate
+static inline double rng_exp(rng* r, double rate) {
+    return -log(1.0-rng_uniform(r))/rate;
+}
+
+//Next unit exponential variate, refilling the block when it runs out
+static inline double expblock_next(expblock* b) {
+    if(b->next == EXPBLOCK) {
+        rng_exp_fill(b->gen, 1.0, b->vals, EXPBLOCK);
+        b->next = 0;
+    }
+    return b->vals[b->next++];
+}
+
+#endif // RNG_H_INCLUDED
@@ -0,0 +1,149 @@
+#include "sim.h"
+
+static int   _worse(const simbusy* busy, int a, int b);
+static void  _settle(simbusy* busy, int i, int server);
+
+simresult* new_simresult(int n) {
+    simresult* r = (simresult*)calloc(1, sizeof(simresult));
+    if(r == NULL)
+        return NULL;
+    r->servers  = n;
+    r->utilized = (double*)calloc(n, sizeof(double));
+    r->served   = (int*)calloc(n, sizeof(int));
+    r->qlen_share = (double*)calloc(CQ_LENGTHS, sizeof(double));
+    r->wait     = new_tally();
+    r->sojourn  = new_tally();
+    r->arrive_slack = new_tally();
+    r->finish_slack = new_tally();
+    r->windows  = (winstat*)calloc(PROFILE_WINDOWS, sizeof(winstat));
+    if(!r->utilized || !r->served || !r->qlen_share || !r->wait || !r->sojourn ||
+       !r->arrive_slack || !r->finish_slack || !r->windows) {
+        destroy_simresult(r);
+        return NULL;
+    }
+    return r;
+}
+
+void destroy_simresult(simresult* r) {
+    if(r == NULL)
+        return;
+    free(r->utilized);
+    free(r->served);
+    free(r->qlen_share);
+    destroy_tally(r->wait);
+    destroy_tally(r->sojourn);
+    destroy_tally(r->arrive_slack);
+    destroy_tally(r->finish_slack);
+    free(r->windows);
+    free(r);
+    return;
+}
+
+//Set the mode with its argument as cqmode_parse handed it over, filling
+//in defaults from mu so set that first
+void simconfig_mode(simconfig* cfg, cqmode m, double arg) {
+    cfg->mode    = m;
+    cfg->quantum = 0;
+    cfg->classes = 1;
+    //A tenth of the mean job unless told otherwise
+    if(m == RR)
+        cfg->quantum = (arg > 0) ? arg : 0.1/cfg->mu;
+    if(m == PRIO)
+        cfg->classes = (arg >= 1) ? ((arg < CQ_CLASSES) ? (int)arg : CQ_CLASSES) : 2;
+    return;
+}
+
+int simbusy_init(simbusy* b, int n) {
+    b->heap = (int*)malloc(n*sizeof(int));
+    b->pos  = (int*)malloc(n*sizeof(int));
+    b->key  = (double*)malloc(n*sizeof(double));
+    if(!b->heap || !b->pos || !b->key)
+        return -1;
+    simbusy_clear(b, n);
+    return 0;
+}
+
+//Every server idle
+void simbusy_clear(simbusy* b, int n) {
+    int i;
+    for(i = 0; i < n; i++)
+        b->pos[i] = -1;
+    b->count = 0;
+    return;
+}
+
+void simbusy_add(simbusy* b, int server, double key) {
+    b->key[server] = key;
+    _settle(b, b->count++, server);
+    return;
+}
+
+//The last server in the heap fills the hole the idle one leaves
+void simbusy_remove(simbusy* b, int server) {
+    int i = b->pos[server];
+    if(i < 0)
+        return;
+    b->pos[server] = -1;
+    if(i < --b->count)
+        _settle(b, i, b->heap[b->count]);
+    return;
+}
+
+void simbusy_free(simbusy* b) {
+    free(b->heap);
+    free(b->pos);
+    free(b->key);
+    b->heap  = NULL;
+    b->pos   = NULL;
+    b->key   = NULL;
+    b->count = 0;
+    return;
+}
+
+//Rank of a customer running a slice that ends at ends (seconds on the
+//engine's clock), taken as if the clock stood at zero. Ranks never fall
+//as what is left grows and every running customer's left shrinks at the
+//same pace, so these order the running customers for as long as they run.
+double sim_key(const cqdisc* d, const carena* a, cid c, double slice, double ends) {
+    return d->rank(a, c, a->left[c] - slice + ends);
+}
+
+//The busy server whose customer ranks worst, the one a preempting
+//customer would take, with that customer's rank now. Each slice of
+//service ends at ends[i] covering slice[i] of the customer's left.
+int sim_victim(const simbusy* b, const cqdisc* d, const carena* a, cid* current,
+               double* slice, double* ends, double now, double* rank) {
+    int v;
+    if(b->count == 0)
+        return -1;
+    v = b->heap[0];
+    *rank = d->rank(a, current[v], a->left[current[v]] - slice[v] + (ends[v] - now));
+    return v;
+}
+
+//Ties go to the lower numbered server, the one a scan would find first
+int _worse(const simbusy* b, int x, int y) {
+    return b->key[x] > b->key[y] || (b->key[x] == b->key[y] && x < y);
+}
+
+//Settle a server into the hole at i, moving up or down from there
+void _settle(simbusy* b, int i, int server) {
+    int p, ch;
+    while(i > 0 && _worse(b, server, b->heap[p = (i-1)/2])) {
+        b->heap[i] = b->heap[p];
+        b->pos[b->heap[i]] = i;
+        i = p;
+    }
+    while((ch = 2*i+1) < b->count) {
+        if(ch+1 < b->count && _worse(b, b->heap[ch+1], b->heap[ch]))
+            ch++;
+        if(!_worse(b, b->heap[ch], server))
+            break;
+        b->heap[i] = b->heap[ch];
+        b->pos[b->heap[i]] = i;
+        i = ch;
+    }
+    b->heap[i] = server;
+    b->pos[server] = i;
+    return;
+}
@@ -0,0 +1,74 @@
+#ifndef SIM_H_INCLUDED
+#define SIM_H_INCLUDED
+
+#include "customer.h"
+#include "tally.h"
+#include "trace.h"
+#include "dist.h"
+#include "profile.h"
+
+//Structure for holding simulation parameters
+typedef struct _simconfig {
+    double           lambda;          //Arrival rate, one over the mean interarrival time (mean over the profile's cycle)
+    struct _profile* profile;         //Time varying arrival rate (NULL keeps lambda constant)
+    double           mu;              //Service rate, one over the mean job
+    struct _dist*    arrivals;        //Shape of interarrival times (NULL draws exponentials)
+    struct _dist*    service;         //Shape of jobs (NULL draws exponentials)
+    double           rseed;           //Seed for random numbers
+    unsigned long    stream;          //Independent random stream of the seed to draw from
+    int              customers;       //Total number of customers being generated (at most, when adaptive)
+    double           precision;       //Relative 95% half width of the steady mean wait to stop at (0 runs them all)
+    int              servers;         //Total number of servers for simulation
+    enum   _cqmode   mode;            //Insertion mode of the live queue
+    double           quantum;         //Longest stretch of service before going back in line (0 runs to the end)
+    int              classes;         //Priority classes customers are spread over evenly (1 keeps all in class 0)
+    struct _tracemap*    replay;      //Trace arrivals and jobs are read from (NULL draws them)
+    struct _tracewriter* record;      //Trace arrivals and jobs are written to (NULL when off)
+} simconfig;
+
+//Structure for holding simulation results
+typedef struct _simresult {
+    int              servers;         //Number of servers results are kept for
+    int              analyzed;        //Number of customers analyzed
+    double           elapsed;         //Seconds elapsed (simulated or wall)
+    double           qlen_avg;        //Average queue length
+    double           qlen_sigma;      //Standard deviation of queue length
+    double*          qlen_share;      //Share of time the queue held each length (CQ_LENGTHS)
+    double           wait_avg;        //Average waiting time
+    double           wait_sigma;      //Standard deviation of waiting time
+    tally*           wait;            //Distribution of waiting time
+    tally*           sojourn;         //Distribution of time in the system (wait plus service)
+    tally*           arrive_slack;    //Seconds arrivals landed past their deadline (wall clock only)
+    tally*           finish_slack;    //Seconds completions landed past their deadline (wall clock only)
+    long             warmup;          //Customers deleted as warm-up (adaptive runs)
+    double           wait_steady;     //Average waiting time past the warm-up (adaptive runs)
+    double           wait_ci95;       //95% half width of wait_steady by batch means (adaptive runs)
+    int              converged;       //The precision was reached before customers ran out (adaptive runs)
+    winstat*         windows;         //Waits and queue lengths over the profile's cycle (PROFILE_WINDOWS)
+    double           worked;          //Total seconds of service performed
+    double*          utilized;        //Utilization of each server (percent)
+    int*             served;          //Customers served by each server
+} simresult;
+
+//Structure for the customers a set of servers is running, a max-heap on
+//preemption rank so the one a preempting customer would take is on top
+typedef struct _simbusy {
+    int*             heap;            //Busy servers, worst ranked first
+    int*             pos;             //Position of each server in the heap (-1 when idle)
+    double*          key;             //Rank each server's customer keeps while it runs (sim_key)
+    int              count;           //Number of busy servers
+} simbusy;
+
+simresult* new_simresult(int servers);
+void       destroy_simresult(simresult* result);
+void       simconfig_mode(simconfig* config, cqmode mode, double arg);
+int        simbusy_init(simbusy* busy, int servers);
+void       simbusy_clear(simbusy* busy, int servers);
+void       simbusy_add(simbusy* busy, int server, double key);
+void       simbusy_remove(simbusy* busy, int server);
+void       simbusy_free(simbusy* busy);
+double     sim_key(const cqdisc* disc, const carena* arena, cid customer, double slice, double ends);
+int        sim_victim(const simbusy* busy, const cqdisc* disc, const carena* arena, cid* current,
+                      double* slice, double* ends, double now, double* rank);
+
+#endif // SIM_H_INCLUDED
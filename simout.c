@@ -1,6 +1,6 @@
 #include "simout.h"
 
-static WINDOW* mainwin;
+static WINDOW* mainwin = NULL;
 static WINDOW* screen;
 
 void screen_init(char* m) {
@@ -16,7 +16,11 @@ void screen_init(char* m) {
 }
 
 void screen_end(void) {
+    //Headless runs never opened the screen
+    if(mainwin == NULL)
+        return;
     endwin();
+    mainwin = NULL;
 }
 
 void update_server(int stid, double u, int s) {
@@ -31,6 +35,32 @@ void update_server(int stid, double u, int s) {
     refresh();
 }
 
+void update_servers(int n, double* u, int* s) {
+    double lo, hi, sum = 0;
+    int i, total = 0;
+    //Small pools keep one box per server
+    if(n <= SERVER_BOXES) {
+        for(i = 0; i < n; i++)
+            update_server(i, u[i], s[i]);
+        return;
+    }
+    lo = hi = u[0];
+    for(i = 0; i < n; i++) {
+        if(u[i] < lo) lo = u[i];
+        if(u[i] > hi) hi = u[i];
+        sum   += u[i];
+        total += s[i];
+    }
+    curs_set(0);
+    mvwprintw(screen,8,1, "Server Pool Statistics (%d servers)",n);
+    mvwprintw(screen,9,1, "Served   : %d ",total);
+    mvwprintw(screen,10,1,"Utilized : %3.2lf%% average ",sum/n);
+    mvwprintw(screen,11,1,"Range    : %3.2lf%% to %3.2lf%% ",lo,hi);
+    mvwprintw(screen,12,1,"-----------------------------------------------");
+    wrefresh(screen);
+    refresh();
+}
+
 void update_queue_stats(double a, double s) {
     mvwprintw(screen,4,1,"Queue Length Statistics");
     mvwprintw(screen,5,1,"Average  : %.2lf ", a);
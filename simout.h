@@ -3,9 +3,13 @@
 
 #include <ncurses.h>
 
+//Most servers that still get a box of their own on screen
+#define SERVER_BOXES 5
+
 void screen_init(char* mode);
 void screen_end(void);
 void update_server(int stid, double utilized, int served);
+void update_servers(int servers, double* utilized, int* served);
 void update_queue_stats(double average, double sigma);
 void update_wait_stats(double average, double sigma);
 void update_progress(double seconds, double utilized, int served, int total, int servers);
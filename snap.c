@@ -0,0 +1,755 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include "snap.h"
+#include "dist.h"
+
+//Layout version of the file
+#define SNAP_VERSION 2
+
+//Structure for finding a customer of the line a delta is taken against
+typedef struct _snapkey {
+    long             born;            //Time the customer entered the system
+    long             at;              //Place in the line
+} snapkey;
+
+static int       _put(FILE* f, const void* p, size_t n);
+static int       _get(FILE* f, void* p, size_t n);
+static int       _put_spec(FILE* f, const char* spec);
+static int       _get_spec(FILE* f, char** spec);
+static int       _put_state(FILE* f, const snapshot* s);
+static int       _get_state(FILE* f, snapshot* s);
+static int       _put_cust(FILE* f, const snapcust* k, int served);
+static int       _get_cust(FILE* f, snapcust* k, int served);
+static int       _put_line(FILE* f, const snapshot* s, const snapshot* prev);
+static int       _get_line(FILE* f, snapshot* s);
+static int       _put_stats(FILE* f, const snapshot* s, const snapshot* prev);
+static int       _get_stats(FILE* f, snapshot* s, int fresh);
+static int       _put_tally(FILE* f, const tally* t, const tally* prev);
+static int       _get_tally(FILE* f, tally* t, int fresh);
+static int       _put_steady(FILE* f, const steady* s, const steady* prev);
+static int       _get_steady(FILE* f, steady* s);
+static int       _append(const snapshot* s, const snapshot* prev, const char* path);
+static int       _get_delta(FILE* f, snapshot* s);
+static long      _find(const snapkey* keys, const snapshot* prev, const snapcust* k);
+static int       _same(const snapcust* a, const snapcust* b);
+static int       _bykey(const void* a, const void* b);
+static int       _storage(snapshot* s, int servers, int adaptive);
+static snapcust* _slot(snapshot* s, snapcust** v, long* size, long n);
+static long      _now(void);
+
+//Parameters are copied from the run's configuration, the replayed trace
+//is only known by the path it was opened from
+snapshot* new_snapshot(const simconfig* cfg, const char* replay) {
+    snapshot* s = (snapshot*)calloc(1, sizeof(snapshot));
+    const char* spec[4];
+    int i;
+    if(s == NULL)
+        return NULL;
+    s->lambda    = cfg->lambda;
+    s->mu        = cfg->mu;
+    s->rseed     = cfg->rseed;
+    s->precision = cfg->precision;
+    s->customers = cfg->customers;
+    s->servers   = cfg->servers;
+    s->mode      = cfg->mode;
+    s->quantum   = cfg->quantum;
+    s->classes   = cfg->classes;
+    spec[0] = cfg->arrivals ? cfg->arrivals->spec : NULL;
+    spec[1] = cfg->service  ? cfg->service->spec  : NULL;
+    spec[2] = cfg->profile  ? cfg->profile->spec  : NULL;
+    spec[3] = replay;
+    for(i = 0; i < 4; i++) {
+        if(spec[i] && (s->spec[i] = strdup(spec[i])) == NULL) {
+            destroy_snapshot(s);
+            return NULL;
+        }
+    }
+    if(_storage(s, cfg->servers, cfg->precision > 0)) {
+        destroy_snapshot(s);
+        return NULL;
+    }
+    return s;
+}
+
+void destroy_snapshot(snapshot* s) {
+    int i;
+    if(s == NULL)
+        return;
+    for(i = 0; i < 4; i++)
+        free(s->spec[i]);
+    free(s->line);
+    free(s->done);
+    free(s->worked);
+    free(s->finished);
+    destroy_tally(s->wait);
+    destroy_tally(s->sojourn);
+    destroy_steady(s->steady);
+    free(s);
+    return;
+}
+
+//Start over on a cut, customers are copied out of arena with times taken
+//from epoch on
+void snapshot_begin(snapshot* s, const carena* a, long epoch, long now) {
+    s->arena   = a;
+    s->epoch   = epoch;
+    s->clock   = now - epoch;
+    s->waiting = 0;
+    s->served  = 0;
+    s->failed  = 0;
+    return;
+}
+
+void snapshot_wait(snapshot* s, cid c, double left) {
+    snapcust* k = _slot(s, &s->line, &s->linesize, s->waiting);
+    if(k == NULL)
+        return;
+    k->born = s->arena->born[c] - s->epoch;
+    k->died = 0;
+    k->job  = s->arena->job[c];
+    k->left = left;
+    k->prio = s->arena->prio[c];
+    s->waiting++;
+    return;
+}
+
+void snapshot_done(snapshot* s, cid c, long died) {
+    snapcust* k = _slot(s, &s->done, &s->donesize, s->served);
+    if(k == NULL)
+        return;
+    k->born = s->arena->born[c] - s->epoch;
+    k->died = died - s->epoch;
+    k->job  = s->arena->job[c];
+    k->left = 0;
+    k->prio = s->arena->prio[c];
+    s->served++;
+    return;
+}
+
+//Visitors for cqueue_walk, owed and served as the arena has them
+void snap_waiting(cid c, void* s) {
+    snapshot_wait((snapshot*)s, c, ((snapshot*)s)->arena->left[c]);
+}
+
+void snap_served(cid c, void* s) {
+    snapshot_done((snapshot*)s, c, ((snapshot*)s)->arena->died[c]);
+}
+
+//Appends what changed since the snapshot path already holds, or writes
+//a whole new file when asked to, when path holds none of this run and
+//once the deltas appended reach SNAP_DELTAS times the snapshot they
+//apply to
+int snapshot_save(const snapshot* s, const char* path, int whole) {
+    snapshot* prev = whole ? NULL : snapshot_read(path);
+    int bad;
+    if(prev == NULL || prev->servers != s->servers || prev->clock > s->clock ||
+       prev->bytes - prev->base > SNAP_DELTAS*prev->base) {
+        destroy_snapshot(prev);
+        return snapshot_write(s, path);
+    }
+    //A delta cut short by a crash is dropped before the next goes on
+    bad = truncate(path, prev->bytes) || _append(s, prev, path);
+    destroy_snapshot(prev);
+    return bad;
+}
+
+//Written next to the path and renamed over it once complete, so the
+//last snapshot survives a crash in the middle of writing the next one
+int snapshot_write(const snapshot* s, const char* path) {
+    char*    tmp;
+    FILE*    out;
+    char     magic[8] = "iQsnap";
+    unsigned int version = SNAP_VERSION;
+    int      i, bad = 0;
+    const snapcust* k;
+
+    if((tmp = (char*)malloc(strlen(path) + 5)) == NULL)
+        return -1;
+    sprintf(tmp, "%s.tmp", path);
+    if((out = fopen(tmp, "wb")) == NULL) {
+        free(tmp);
+        return -1;
+    }
+    //Parameters of the run
+    bad |= _put(out, magic, sizeof(magic));
+    bad |= _put(out, &version, sizeof(version));
+    bad |= _put(out, &s->lambda, sizeof(s->lambda));
+    bad |= _put(out, &s->mu, sizeof(s->mu));
+    bad |= _put(out, &s->rseed, sizeof(s->rseed));
+    bad |= _put(out, &s->precision, sizeof(s->precision));
+    bad |= _put(out, &s->customers, sizeof(s->customers));
+    bad |= _put(out, &s->servers, sizeof(s->servers));
+    bad |= _put(out, &s->mode, sizeof(s->mode));
+    bad |= _put(out, &s->quantum, sizeof(s->quantum));
+    bad |= _put(out, &s->classes, sizeof(s->classes));
+    for(i = 0; i < 4; i++)
+        bad |= _put_spec(out, s->spec[i]);
+    bad |= _put_state(out, s);
+    //Customers, only the fields each list needs
+    bad |= _put(out, &s->waiting, sizeof(s->waiting));
+    for(k = s->line; k < s->line + s->waiting && !bad; k++)
+        bad |= _put_cust(out, k, 0);
+    bad |= _put(out, &s->served, sizeof(s->served));
+    for(k = s->done; k < s->done + s->served && !bad; k++)
+        bad |= _put_cust(out, k, 1);
+    bad |= _put_stats(out, s, NULL);
+    bad |= _put(out, magic, sizeof(magic));
+
+    //The old snapshot is only replaced by one that made it to the disk
+    bad |= (fflush(out) != 0) || (fsync(fileno(out)) != 0);
+    bad |= (fclose(out) != 0);
+    if(bad || rename(tmp, path)) {
+        remove(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+//Returns NULL on a file that is missing, cut short or not a snapshot.
+//Deltas are applied in order up to the first one a crash cut short.
+snapshot* snapshot_read(const char* path) {
+    snapshot* s;
+    FILE*     in;
+    char      magic[8];
+    unsigned int version;
+    int       i, r = 0, bad = 0;
+    snapcust* k;
+
+    if((in = fopen(path, "rb")) == NULL)
+        return NULL;
+    if((s = (snapshot*)calloc(1, sizeof(snapshot))) == NULL) {
+        fclose(in);
+        return NULL;
+    }
+    bad |= _get(in, magic, sizeof(magic));
+    bad |= _get(in, &version, sizeof(version));
+    bad |= bad || strncmp(magic, "iQsnap", sizeof(magic)) || version != SNAP_VERSION;
+    bad |= _get(in, &s->lambda, sizeof(s->lambda));
+    bad |= _get(in, &s->mu, sizeof(s->mu));
+    bad |= _get(in, &s->rseed, sizeof(s->rseed));
+    bad |= _get(in, &s->precision, sizeof(s->precision));
+    bad |= _get(in, &s->customers, sizeof(s->customers));
+    bad |= _get(in, &s->servers, sizeof(s->servers));
+    bad |= _get(in, &s->mode, sizeof(s->mode));
+    bad |= _get(in, &s->quantum, sizeof(s->quantum));
+    bad |= _get(in, &s->classes, sizeof(s->classes));
+    for(i = 0; i < 4 && !bad; i++)
+        bad |= _get_spec(in, &s->spec[i]);
+    bad |= bad || s->servers <= 0 || s->customers < 0 || s->mode < FIFO || s->mode >= CQ_MODES;
+    bad |= bad || _storage(s, s->servers, s->precision > 0);
+    bad |= bad || _get_state(in, s);
+    bad |= _get(in, &s->waiting, sizeof(s->waiting));
+    for(i = 0; !bad && i < s->waiting; i++) {
+        if((k = _slot(s, &s->line, &s->linesize, i)) == NULL)
+            break;
+        bad |= _get_cust(in, k, 0);
+    }
+    bad |= _get(in, &s->served, sizeof(s->served));
+    for(i = 0; !bad && i < s->served; i++) {
+        if((k = _slot(s, &s->done, &s->donesize, i)) == NULL)
+            break;
+        bad |= _get_cust(in, k, 1);
+    }
+    bad |= s->failed;
+    bad |= bad || _get_stats(in, s, 1);
+    bad |= _get(in, magic, sizeof(magic));
+    bad |= bad || strncmp(magic, "iQsnap", sizeof(magic));
+    s->base = s->bytes = ftell(in);
+    while(!bad && (r = _get_delta(in, s)) == 0)
+        s->bytes = ftell(in);
+    bad |= (r < 0);
+    fclose(in);
+    if(bad) {
+        destroy_snapshot(s);
+        return NULL;
+    }
+    return s;
+}
+
+//Stop every thread taking part at its next safe point. Gives up after
+//SNAP_PATIENCE, a thread can be held up by the statistics thread itself
+//when a lock-free queue fills, and the cut is tried again later.
+int snap_cut(snapcut* cut) {
+    long until = _now() + (long)(SNAP_PATIENCE*1e9);
+    atomic_store(&cut->cutting, 1);
+    while(atomic_load(&cut->stopped) < cut->threads) {
+        if(_now() > until) {
+            atomic_store(&cut->cutting, 0);
+            return -1;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+void snap_release(snapcut* cut) {
+    atomic_store(&cut->cutting, 0);
+}
+
+//Leave a safe point. A thread finding a cut under way goes back to being
+//stopped until it is over, the cutter has either seen it leave or it has
+//seen the cut.
+void snap_go(snapcut* cut) {
+    if(cut == NULL)
+        return;
+    while(1) {
+        atomic_fetch_sub(&cut->stopped, 1);
+        if(!atomic_load(&cut->cutting))
+            return;
+        atomic_fetch_add(&cut->stopped, 1);
+        while(atomic_load(&cut->cutting))
+            sched_yield();
+    }
+}
+
+//Leave a safe point taken while waiting on a condition, letting go of
+//its mutex for as long as a cut holds us up
+void snap_go_locked(snapcut* cut, pthread_mutex_t* m) {
+    if(cut == NULL)
+        return;
+    while(1) {
+        atomic_fetch_sub(&cut->stopped, 1);
+        if(!atomic_load(&cut->cutting))
+            return;
+        atomic_fetch_add(&cut->stopped, 1);
+        pthread_mutex_unlock(m);
+        while(atomic_load(&cut->cutting))
+            sched_yield();
+        pthread_mutex_lock(m);
+    }
+}
+
+int _put(FILE* f, const void* p, size_t n) {
+    return n > 0 && fwrite(p, n, 1, f) != 1;
+}
+
+int _get(FILE* f, void* p, size_t n) {
+    return n > 0 && fread(p, n, 1, f) != 1;
+}
+
+//Length first, -1 for a specification that was not given
+int _put_spec(FILE* f, const char* spec) {
+    int n = spec ? (int)strlen(spec) : -1;
+    return _put(f, &n, sizeof(n)) || (spec && _put(f, spec, n));
+}
+
+int _get_spec(FILE* f, char** spec) {
+    int n;
+    if(_get(f, &n, sizeof(n)) || n < -1 || n > 4096)
+        return -1;
+    if(n < 0)
+        return 0;
+    if((*spec = (char*)malloc(n+1)) == NULL || _get(f, *spec, n))
+        return -1;
+    (*spec)[n] = '\0';
+    return 0;
+}
+
+//Arrival generator, servers and the live queue's length, the unit
+//exponentials not handed out yet are kept
+int _put_state(FILE* f, const snapshot* s) {
+    int bad = 0;
+    bad |= _put(f, &s->clock, sizeof(s->clock));
+    bad |= _put(f, &s->gen.made, sizeof(s->gen.made));
+    bad |= _put(f, &s->gen.done, sizeof(s->gen.done));
+    bad |= _put(f, &s->gen.due, sizeof(s->gen.due));
+    bad |= _put(f, &s->gen.delta, sizeof(s->gen.delta));
+    bad |= _put(f, &s->gen.job, sizeof(s->gen.job));
+    bad |= _put(f, &s->gen.at, sizeof(s->gen.at));
+    bad |= _put(f, &s->gen.random, sizeof(rng));
+    bad |= _put(f, &s->gen.classes, sizeof(rng));
+    bad |= _put(f, &s->gen.draws.next, sizeof(s->gen.draws.next));
+    if(s->gen.draws.next < EXPBLOCK)
+        bad |= _put(f, &s->gen.draws.vals[s->gen.draws.next], (EXPBLOCK - s->gen.draws.next)*sizeof(double));
+    bad |= _put(f, &s->gen.pace, sizeof(profcur));
+    bad |= _put(f, &s->cursor, sizeof(s->cursor));
+    bad |= _put(f, &s->stop, sizeof(s->stop));
+    bad |= _put(f, s->worked, s->servers*sizeof(double));
+    bad |= _put(f, s->finished, s->servers*sizeof(int));
+    bad |= _put(f, &s->length.start, sizeof(double));
+    bad |= _put(f, &s->length.length, sizeof(long));
+    bad |= _put(f, &s->length.m1, sizeof(double));
+    bad |= _put(f, &s->length.m2, sizeof(double));
+    bad |= _put(f, s->length.hist, CQ_LENGTHS*sizeof(double));
+    return bad;
+}
+
+int _get_state(FILE* f, snapshot* s) {
+    int bad = 0;
+    bad |= _get(f, &s->clock, sizeof(s->clock));
+    bad |= _get(f, &s->gen.made, sizeof(s->gen.made));
+    bad |= _get(f, &s->gen.done, sizeof(s->gen.done));
+    bad |= _get(f, &s->gen.due, sizeof(s->gen.due));
+    bad |= _get(f, &s->gen.delta, sizeof(s->gen.delta));
+    bad |= _get(f, &s->gen.job, sizeof(s->gen.job));
+    bad |= _get(f, &s->gen.at, sizeof(s->gen.at));
+    bad |= _get(f, &s->gen.random, sizeof(rng));
+    bad |= _get(f, &s->gen.classes, sizeof(rng));
+    bad |= _get(f, &s->gen.draws.next, sizeof(s->gen.draws.next));
+    bad |= bad || s->gen.draws.next < 0 || s->gen.draws.next > EXPBLOCK;
+    if(!bad && s->gen.draws.next < EXPBLOCK)
+        bad |= _get(f, &s->gen.draws.vals[s->gen.draws.next], (EXPBLOCK - s->gen.draws.next)*sizeof(double));
+    bad |= _get(f, &s->gen.pace, sizeof(profcur));
+    bad |= _get(f, &s->cursor, sizeof(s->cursor));
+    bad |= _get(f, &s->stop, sizeof(s->stop));
+    bad |= _get(f, s->worked, s->servers*sizeof(double));
+    bad |= _get(f, s->finished, s->servers*sizeof(int));
+    bad |= _get(f, &s->length.start, sizeof(double));
+    bad |= _get(f, &s->length.length, sizeof(long));
+    bad |= _get(f, &s->length.m1, sizeof(double));
+    bad |= _get(f, &s->length.m2, sizeof(double));
+    bad |= _get(f, s->length.hist, CQ_LENGTHS*sizeof(double));
+    return bad;
+}
+
+//Waiting customers keep what they are owed and their class, served ones
+//when they left
+int _put_cust(FILE* f, const snapcust* k, int served) {
+    int bad = 0;
+    bad |= _put(f, &k->born, sizeof(k->born));
+    if(served)
+        bad |= _put(f, &k->died, sizeof(k->died));
+    bad |= _put(f, &k->job, sizeof(k->job));
+    if(served)
+        return bad;
+    bad |= _put(f, &k->left, sizeof(k->left));
+    bad |= _put(f, &k->prio, sizeof(k->prio));
+    return bad;
+}
+
+int _get_cust(FILE* f, snapcust* k, int served) {
+    int bad = 0;
+    k->died = 0;
+    k->left = 0;
+    k->prio = 0;
+    bad |= _get(f, &k->born, sizeof(k->born));
+    if(served)
+        bad |= _get(f, &k->died, sizeof(k->died));
+    bad |= _get(f, &k->job, sizeof(k->job));
+    if(served)
+        return bad;
+    bad |= _get(f, &k->left, sizeof(k->left));
+    bad |= _get(f, &k->prio, sizeof(k->prio));
+    return bad;
+}
+
+//The line as runs, each either a stretch the previous line holds in the
+//same order (from its place there) or customers written out (from -1).
+//A long line mostly moves up, so a delta of it stays short.
+int _put_line(FILE* f, const snapshot* s, const snapshot* prev) {
+    snapkey* keys;
+    long     i, j, from, n;
+    int      bad = 0;
+
+    if((keys = (snapkey*)malloc((prev->waiting + 1)*sizeof(snapkey))) == NULL)
+        return -1;
+    for(i = 0; i < prev->waiting; i++) {
+        keys[i].born = prev->line[i].born;
+        keys[i].at   = i;
+    }
+    qsort(keys, prev->waiting, sizeof(snapkey), _bykey);
+    bad |= _put(f, &s->waiting, sizeof(s->waiting));
+    for(i = 0; i < s->waiting && !bad; i = j) {
+        from = _find(keys, prev, &s->line[i]);
+        if(from >= 0) {
+            for(j = i+1; j < s->waiting && from + (j-i) < prev->waiting &&
+                _same(&s->line[j], &prev->line[from + (j-i)]); j++);
+        } else {
+            for(j = i+1; j < s->waiting && _find(keys, prev, &s->line[j]) < 0; j++);
+        }
+        n = j - i;
+        bad |= _put(f, &from, sizeof(from));
+        bad |= _put(f, &n, sizeof(n));
+        for(; from < 0 && i < j && !bad; i++)
+            bad |= _put_cust(f, &s->line[i], 0);
+    }
+    free(keys);
+    return bad;
+}
+
+//Replaces the line with the one a delta holds
+int _get_line(FILE* f, snapshot* s) {
+    snapcust* line;
+    long      waiting, i, from, n;
+    int       bad = 0;
+
+    if(_get(f, &waiting, sizeof(waiting)) || waiting < 0 ||
+       (line = (snapcust*)malloc((waiting + 1)*sizeof(snapcust))) == NULL)
+        return -1;
+    for(i = 0; i < waiting && !bad; ) {
+        bad |= _get(f, &from, sizeof(from));
+        bad |= _get(f, &n, sizeof(n));
+        bad |= bad || n <= 0 || n > waiting - i || from < -1 || (from >= 0 && from + n > s->waiting);
+        if(!bad && from >= 0) {
+            memcpy(&line[i], &s->line[from], n*sizeof(snapcust));
+            i += n;
+        }
+        for(; !bad && from < 0 && n > 0; n--)
+            bad |= _get_cust(f, &line[i++], 0);
+    }
+    if(bad) {
+        free(line);
+        return -1;
+    }
+    free(s->line);
+    s->line     = line;
+    s->linesize = waiting + 1;
+    s->waiting  = waiting;
+    return 0;
+}
+
+//Statistics of the analyzed customers, the tallies and the steady state
+//estimate as changed since prev (everything when NULL)
+int _put_stats(FILE* f, const snapshot* s, const snapshot* prev) {
+    int bad = 0;
+    bad |= _put(f, &s->analyzed, sizeof(s->analyzed));
+    bad |= _put(f, &s->work, sizeof(s->work));
+    bad |= _put(f, &s->sampled, sizeof(s->sampled));
+    bad |= _put_tally(f, s->wait, prev ? prev->wait : NULL);
+    bad |= _put_tally(f, s->sojourn, prev ? prev->sojourn : NULL);
+    bad |= _put(f, s->windows, sizeof(s->windows));
+    bad |= _put_steady(f, s->steady, prev ? prev->steady : NULL);
+    return bad;
+}
+
+int _get_stats(FILE* f, snapshot* s, int fresh) {
+    int bad = 0;
+    bad |= _get(f, &s->analyzed, sizeof(s->analyzed));
+    bad |= _get(f, &s->work, sizeof(s->work));
+    bad |= _get(f, &s->sampled, sizeof(s->sampled));
+    bad |= bad || _get_tally(f, s->wait, fresh) || _get_tally(f, s->sojourn, fresh);
+    bad |= _get(f, s->windows, sizeof(s->windows));
+    //Adaptive runs carry their estimate, others a marker saying there is none
+    bad |= bad || _get_steady(f, s->steady);
+    return bad;
+}
+
+//Most buckets of a tally stay empty or unchanged since prev, only the
+//others are written
+int _put_tally(FILE* f, const tally* t, const tally* prev) {
+    int i, n = 0, bad = 0;
+    for(i = 0; i < TALLY_BUCKETS; i++)
+        n += (t->buckets[i] != (prev ? prev->buckets[i] : 0));
+    bad |= _put(f, &t->count, sizeof(t->count));
+    bad |= _put(f, &t->mean, sizeof(t->mean));
+    bad |= _put(f, &t->m2, sizeof(t->m2));
+    bad |= _put(f, &t->min, sizeof(t->min));
+    bad |= _put(f, &t->max, sizeof(t->max));
+    bad |= _put(f, &n, sizeof(n));
+    for(i = 0; i < TALLY_BUCKETS && !bad; i++) {
+        if(t->buckets[i] == (prev ? prev->buckets[i] : 0))
+            continue;
+        bad |= _put(f, &i, sizeof(i));
+        bad |= _put(f, &t->buckets[i], sizeof(t->buckets[i]));
+    }
+    return bad;
+}
+
+int _get_tally(FILE* f, tally* t, int fresh) {
+    int i, b, n, bad = 0;
+    if(fresh)
+        tally_init(t);
+    bad |= _get(f, &t->count, sizeof(t->count));
+    bad |= _get(f, &t->mean, sizeof(t->mean));
+    bad |= _get(f, &t->m2, sizeof(t->m2));
+    bad |= _get(f, &t->min, sizeof(t->min));
+    bad |= _get(f, &t->max, sizeof(t->max));
+    bad |= _get(f, &n, sizeof(n));
+    for(i = 0; i < n && !bad; i++) {
+        bad |= _get(f, &b, sizeof(b));
+        bad |= bad || b < 0 || b >= TALLY_BUCKETS;
+        bad |= bad || _get(f, &t->buckets[b], sizeof(t->buckets[b]));
+    }
+    return bad;
+}
+
+//A count of -1 stands for no estimate at all. Batch means only change
+//when neighbours are averaged, until then those prev holds are kept.
+int _put_steady(FILE* f, const steady* s, const steady* prev) {
+    long none = -1;
+    long kept = (prev && prev->batch == s->batch && prev->count <= s->count) ? prev->count : 0;
+    int  bad = 0;
+    if(s == NULL)
+        return _put(f, &none, sizeof(none));
+    bad |= _put(f, &s->count, sizeof(s->count));
+    bad |= _put(f, &kept, sizeof(kept));
+    bad |= _put(f, s->means + kept, (s->count - kept)*sizeof(double));
+    bad |= _put(f, &s->batch, sizeof(s->batch));
+    bad |= _put(f, &s->partial, sizeof(s->partial));
+    bad |= _put(f, &s->filled, sizeof(s->filled));
+    bad |= _put(f, &s->seen, sizeof(s->seen));
+    bad |= _put(f, &s->check, sizeof(s->check));
+    bad |= _put(f, &s->target, sizeof(s->target));
+    bad |= _put(f, &s->warmup, sizeof(s->warmup));
+    bad |= _put(f, &s->mean, sizeof(s->mean));
+    bad |= _put(f, &s->half, sizeof(s->half));
+    bad |= _put(f, &s->done, sizeof(s->done));
+    return bad;
+}
+
+int _get_steady(FILE* f, steady* s) {
+    long count, kept;
+    int  bad = 0;
+    if(_get(f, &count, sizeof(count)))
+        return -1;
+    if(s == NULL || count < 0)
+        return (s == NULL) != (count < 0);
+    if(count > STEADY_KEPT || _get(f, &kept, sizeof(kept)) || kept < 0 || kept > count || kept > s->count)
+        return -1;
+    s->count = count;
+    bad |= _get(f, s->means + kept, (s->count - kept)*sizeof(double));
+    bad |= _get(f, &s->batch, sizeof(s->batch));
+    bad |= _get(f, &s->partial, sizeof(s->partial));
+    bad |= _get(f, &s->filled, sizeof(s->filled));
+    bad |= _get(f, &s->seen, sizeof(s->seen));
+    bad |= _get(f, &s->check, sizeof(s->check));
+    bad |= _get(f, &s->target, sizeof(s->target));
+    bad |= _get(f, &s->warmup, sizeof(s->warmup));
+    bad |= _get(f, &s->mean, sizeof(s->mean));
+    bad |= _get(f, &s->half, sizeof(s->half));
+    bad |= _get(f, &s->done, sizeof(s->done));
+    return bad;
+}
+
+//A delta goes down in one write once it is put together, framed by its
+//length and a closing magic, so a reader can tell one cut short
+int _append(const snapshot* s, const snapshot* prev, const char* path) {
+    FILE*    out;
+    FILE*    mem;
+    char*    buf = NULL;
+    size_t   size = 0;
+    char     magic[8] = "iQsnap";
+    char     delta[8] = "iQdelta";
+    long     length;
+    int      bad = 0;
+    const snapcust* k;
+
+    if((mem = open_memstream(&buf, &size)) == NULL)
+        return -1;
+    bad |= _put_state(mem, s);
+    bad |= _put_line(mem, s, prev);
+    bad |= _put(mem, &s->served, sizeof(s->served));
+    for(k = s->done; k < s->done + s->served && !bad; k++)
+        bad |= _put_cust(mem, k, 1);
+    bad |= _put_stats(mem, s, prev);
+    bad |= (fclose(mem) != 0);
+    if(bad || (out = fopen(path, "ab")) == NULL) {
+        free(buf);
+        return -1;
+    }
+    length = (long)size;
+    bad |= _put(out, delta, sizeof(delta));
+    bad |= _put(out, &length, sizeof(length));
+    bad |= _put(out, buf, size);
+    bad |= _put(out, magic, sizeof(magic));
+    bad |= (fflush(out) != 0) || (fsync(fileno(out)) != 0);
+    bad |= (fclose(out) != 0);
+    free(buf);
+    return bad ? -1 : 0;
+}
+
+//Apply the next delta. Returns 1 at the end of the file or on a delta a
+//crash cut short, -1 on one that does not fit the snapshot.
+int _get_delta(FILE* f, snapshot* s) {
+    FILE*     in;
+    char*     buf;
+    char      magic[8];
+    long      length;
+    int       i, bad = 0;
+    snapcust* k;
+
+    if(_get(f, magic, sizeof(magic)) || _get(f, &length, sizeof(length)))
+        return 1;
+    if(strncmp(magic, "iQdelta", sizeof(magic)) || length <= 0 || (buf = (char*)malloc(length)) == NULL)
+        return 1;
+    if(_get(f, buf, length) || _get(f, magic, sizeof(magic)) || strncmp(magic, "iQsnap", sizeof(magic))) {
+        free(buf);
+        return 1;
+    }
+    if((in = fmemopen(buf, length, "rb")) == NULL) {
+        free(buf);
+        return -1;
+    }
+    bad |= _get_state(in, s);
+    bad |= bad || _get_line(in, s);
+    bad |= _get(in, &s->served, sizeof(s->served));
+    for(i = 0; !bad && i < s->served; i++) {
+        if((k = _slot(s, &s->done, &s->donesize, i)) == NULL)
+            break;
+        bad |= _get_cust(in, k, 1);
+    }
+    bad |= s->failed;
+    bad |= bad || _get_stats(in, s, 0);
+    bad |= bad || fgetc(in) != EOF;
+    fclose(in);
+    free(buf);
+    return bad ? -1 : 0;
+}
+
+//Place in prev's line of a customer just like k, -1 if there is none
+long _find(const snapkey* keys, const snapshot* prev, const snapcust* k) {
+    long lo = 0, hi = prev->waiting, mid;
+    while(lo < hi) {
+        mid = (lo + hi)/2;
+        if(keys[mid].born < k->born)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for(; lo < prev->waiting && keys[lo].born == k->born; lo++) {
+        if(_same(&prev->line[keys[lo].at], k))
+            return keys[lo].at;
+    }
+    return -1;
+}
+
+int _same(const snapcust* a, const snapcust* b) {
+    return a->born == b->born && a->job == b->job && a->left == b->left && a->prio == b->prio;
+}
+
+int _bykey(const void* a, const void* b) {
+    const snapkey* x = (const snapkey*)a;
+    const snapkey* y = (const snapkey*)b;
+    return (x->born > y->born) - (x->born < y->born);
+}
+
+int _storage(snapshot* s, int servers, int adaptive) {
+    s->worked   = (double*)calloc(servers, sizeof(double));
+    s->finished = (int*)calloc(servers, sizeof(int));
+    s->wait     = new_tally();
+    s->sojourn  = new_tally();
+    s->steady   = adaptive ? new_steady() : NULL;
+    if(!s->worked || !s->finished || !s->wait || !s->sojourn || (adaptive && !s->steady))
+        return -1;
+    return 0;
+}
+
+//Slot n of a customer list, doubling it when full. Lists are kept from
+//one cut to the next, so they seldom grow while the threads are stopped.
+snapcust* _slot(snapshot* s, snapcust** v, long* size, long n) {
+    snapcust* grown;
+    long      want;
+    if(n < *size)
+        return &(*v)[n];
+    want  = (*size > 0) ? 2*(*size) : 1024;
+    grown = (snapcust*)realloc(*v, want*sizeof(snapcust));
+    if(grown == NULL) {
+        s->failed = 1;
+        return NULL;
+    }
+    *v    = grown;
+    *size = want;
+    return &(*v)[n];
+}
+
+long _now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000L + t.tv_nsec;
+}
@@ -0,0 +1,127 @@
+#ifndef SNAP_H_INCLUDED
+#define SNAP_H_INCLUDED
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "customer.h"
+#include "sim.h"
+#include "rng.h"
+#include "trace.h"
+#include "profile.h"
+#include "tally.h"
+#include "steady.h"
+
+//Seconds between snapshots unless -C says otherwise
+#define SNAP_INTERVAL 10.0
+//Seconds a cut waits for every thread to stop before giving up for now
+#define SNAP_PATIENCE 0.1
+//Times the whole snapshot a file starts with that the deltas appended to
+//it may add up to before it is written whole again
+#define SNAP_DELTAS   4
+
+//Structure for stopping every thread that changes a run at a point where
+//its state is whole. Threads count themselves stopped around each wait,
+//holding no customer in hand, and a cut is taken once all of them are, so
+//nobody stops for longer than forking the process that copies it takes.
+typedef struct _snapcut {
+    atomic_int       cutting;         //A cut is under way, threads leaving a safe point wait it out
+    atomic_int       stopped;         //Threads at a safe point
+    int              threads;         //Threads taking part
+} snapcut;
+
+//Structure for the state of the arrival generator between two customers,
+//the next one's arrival already laid out
+typedef struct _snapgen {
+    int              made;            //Customers generated so far
+    int              done;            //Nobody else is coming
+    long             due;             //Time the next customer arrives (nanoseconds)
+    double           delta;           //Interarrival time of the next customer
+    double           job;             //Job of the next customer (replays, drawn on arrival otherwise)
+    double           at;              //Arrival of the next customer from the start of the run (profiles)
+    rng              random;          //Stream interarrival times and jobs are drawn from
+    rng              classes;         //Stream priority classes are drawn from
+    expblock         draws;           //Unit exponentials drawn from random and not used yet
+    profcur          pace;            //Position in the arrival rate profile
+    tracecur         cursor;          //Position in the replayed trace
+} snapgen;
+
+//Structure for a customer in a snapshot, times from the start of the run
+typedef struct _snapcust {
+    long             born;            //Time customer entered the system (nanoseconds)
+    long             died;            //Time customer left the system (nanoseconds, served customers)
+    double           job;             //Customer's job time (seconds)
+    double           left;            //Service still owed (seconds, waiting customers)
+    int              prio;            //Priority class
+} snapcust;
+
+//Structure for a snapshot of a threaded run, everything it needs to go on
+//from where the snapshot was taken
+typedef struct _snapshot {
+    double           lambda;          //Arrival rate
+    double           mu;              //Service rate
+    double           rseed;           //Seed for random numbers
+    double           precision;       //Relative half width adaptive runs stop at (0 runs them all)
+    int              customers;       //Total number of customers being generated
+    int              servers;         //Total number of servers
+    int              mode;            //Discipline of the live queue (RING for -F)
+    double           quantum;         //Round robin quantum
+    int              classes;         //Priority classes
+    char*            spec[4];         //Specifications of -a, -j, -l and -I (NULL when not given)
+    long             clock;           //Run time the snapshot was taken at (nanoseconds)
+    snapgen          gen;             //Arrival generator, due from the start of the run
+    long             cursor;          //Offset of the next record in the replayed trace
+    int              stop;            //The precision was reached, genesis is stopping
+    long             waiting;         //Customers waiting or in service
+    long             served;          //Customers served and not yet analyzed
+    snapcust*        line;            //Waiting customers, those in service first
+    snapcust*        done;            //Served customers
+    long             linesize;        //Customers line has room for
+    long             donesize;        //Customers done has room for
+    double*          worked;          //Seconds of service each server gave
+    int*             finished;        //Customers each server finished
+    cqstats          length;          //Time weighted length accounting of the live queue
+    long             analyzed;        //Customers analyzed
+    double           work;            //Jobs of analyzed customers put together
+    double           sampled;         //Run time the queue length was last integrated up to (profiles)
+    tally*           wait;            //Wait time of analyzed customers
+    tally*           sojourn;         //Time in the system of analyzed customers
+    winstat          windows[PROFILE_WINDOWS]; //Statistics per window of the profile
+    steady*          steady;          //Steady state wait estimate (NULL unless adaptive)
+    const carena*    arena;           //Arena customers are copied out of for a cut
+    long             epoch;           //Start of the run in the arena's times while a cut is taken
+    int              failed;          //Memory ran out while the cut was taken
+    long             base;            //Bytes of the whole snapshot the file starts with (read snapshots)
+    long             bytes;           //Bytes of the file read, deltas included (read snapshots)
+} snapshot;
+
+snapshot* new_snapshot(const simconfig* config, const char* replay);
+snapshot* snapshot_read(const char* path);
+int       snapshot_write(const snapshot* s, const char* path);
+int       snapshot_save(const snapshot* s, const char* path, int whole);
+void      destroy_snapshot(snapshot* s);
+void      snapshot_begin(snapshot* s, const carena* arena, long epoch, long now);
+void      snapshot_wait(snapshot* s, cid customer, double left);
+void      snapshot_done(snapshot* s, cid customer, long died);
+void      snap_waiting(cid customer, void* s);
+void      snap_served(cid customer, void* s);
+int       snap_cut(snapcut* cut);
+void      snap_release(snapcut* cut);
+void      snap_go(snapcut* cut);
+void      snap_go_locked(snapcut* cut, pthread_mutex_t* lock);
+
+//Enter a safe point, the caller holds nothing a cut could miss until it
+//calls snap_go
+static inline void snap_stop(snapcut* cut) {
+    if(cut != NULL)
+        atomic_fetch_add(&cut->stopped, 1);
+}
+
+//Stop for a cut under way, if any, from a point where the state is whole
+static inline void snap_yield(snapcut* cut) {
+    if(cut == NULL || !atomic_load_explicit(&cut->cutting, memory_order_relaxed))
+        return;
+    snap_stop(cut);
+    snap_go(cut);
+}
+
+#endif // SNAP_H_INCLUDED
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "steady.h"
+
+//Two sided 95% Student t quantiles for 1 to 30 degrees of freedom
+static const double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+steady* new_steady(void) {
+    steady* s = (steady*)calloc(1, sizeof(steady));
+    if(s == NULL)
+        return NULL;
+    if((s->means = (double*)malloc(STEADY_KEPT*sizeof(double))) == NULL) {
+        free(s);
+        return NULL;
+    }
+    steady_init(s, 0);
+    return s;
+}
+
+void destroy_steady(steady* s) {
+    if(s == NULL)
+        return;
+    free(s->means);
+    free(s);
+    return;
+}
+
+void steady_init(steady* s, double target) {
+    s->count   = 0;
+    s->batch   = STEADY_BATCH;
+    s->partial = 0;
+    s->filled  = 0;
+    s->seen    = 0;
+    s->check   = 4*STEADY_GROUPS*STEADY_BATCH;
+    s->target  = target;
+    s->warmup  = 0;
+    s->mean    = 0;
+    s->half    = 0;
+    s->done    = 0;
+    return;
+}
+
+//Both were made by new_steady, so the means always fit
+void steady_copy(steady* into, const steady* from) {
+    double* means = into->means;
+    *into = *from;
+    into->means = means;
+    memcpy(into->means, from->means, from->count*sizeof(double));
+    return;
+}
+
+//Truncate at the d minimizing MSER(d), the variance of what is left over
+//its length, looking only at the first half since the statistic means
+//nothing near the end. A minimum on that boundary means the run has not
+//settled yet. What is left is grouped in STEADY_GROUPS batches, dropping
+//the remainder from the front, for the confidence interval.
+int steady_check(steady* s) {
+    double s1 = 0, s2 = 0, mser, best = 0, sum = 0, ssq = 0, g;
+    long   k = s->count, n, d, trunc = 0, cut, per, i, j;
+
+    s->check = s->seen + s->seen/4;
+    if(k < 4*STEADY_GROUPS)
+        return 0;
+    for(d = k-1; d >= 0; d--) {
+        s1 += s->means[d];
+        s2 += s->means[d]*s->means[d];
+        n   = k-d;
+        if(d > k/2)
+            continue;
+        mser = (s2 - s1*s1/n)/((double)n*n);
+        if(d == k/2 || mser <= best) {
+            best  = mser;
+            trunc = d;
+        }
+    }
+    per  = (k-trunc)/STEADY_GROUPS;
+    cut  = k - per*STEADY_GROUPS;
+    for(i = 0; i < STEADY_GROUPS; i++) {
+        for(g = 0, j = 0; j < per; j++)
+            g += s->means[cut + i*per + j];
+        g   /= per;
+        sum += g;
+        ssq += g*g;
+    }
+    s->warmup = cut*s->batch;
+    s->mean   = sum/STEADY_GROUPS;
+    g = (ssq - sum*sum/STEADY_GROUPS)/(STEADY_GROUPS-1);
+    s->half   = student_t95(STEADY_GROUPS-1)*sqrt(g > 0 ? g : 0)/sqrt(STEADY_GROUPS);
+    s->done   = (trunc < k/2) && s->half <= s->target*s->mean;
+    return s->done;
+}
+
+double student_t95(int df) {
+    if(df < 1)
+        return 0;
+    if(df <= 30)
+        return t95[df-1];
+    //Past the table the normal quantile plus a first order correction
+    return 1.959964 + 2.37/df;
+}
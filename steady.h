@@ -0,0 +1,57 @@
+#ifndef STEADY_H_INCLUDED
+#define STEADY_H_INCLUDED
+
+//Observations in each kept batch to start with (MSER-5)
+#define STEADY_BATCH   5
+//Most batch means kept, past it neighbours are averaged and batches double
+#define STEADY_KEPT    (1 << 20)
+//Batches the data past the warm-up is grouped in for the confidence interval
+#define STEADY_GROUPS  32
+
+//Structure for a steady state estimate of a mean from one long run. The
+//stream is kept as means of small batches, the warm-up is the truncation
+//point minimizing MSER over them and the confidence interval comes from
+//batch means of what is left. Checks run each time the stream grows by a
+//quarter, so the whole run costs O(n) and memory stays bounded.
+typedef struct _steady {
+    double*          means;           //Means of consecutive batches, oldest first
+    long             count;           //Number of batch means kept
+    long             batch;           //Observations per kept batch
+    double           partial;         //Sum of the batch being filled
+    long             filled;          //Observations in the batch being filled
+    long             seen;            //Observations added in total
+    long             check;           //Observations at which the next check is due
+    double           target;          //Relative 95% half width to stop at
+    long             warmup;          //Observations deleted as warm-up at the last check
+    double           mean;            //Mean past the warm-up at the last check
+    double           half;            //95% half width of mean at the last check
+    int              done;            //The last check met the target
+} steady;
+
+steady* new_steady(void);
+void    destroy_steady(steady* s);
+void    steady_init(steady* s, double target);
+void    steady_copy(steady* into, const steady* from);
+int     steady_check(steady* s);
+double  student_t95(int df);
+
+//Add one observation, nonzero once the target is met
+static inline int steady_add(steady* s, double x) {
+    s->partial += x;
+    if(++s->filled == s->batch) {
+        s->means[s->count++] = s->partial/s->batch;
+        s->partial = 0;
+        s->filled  = 0;
+        //Averaging neighbours keeps every batch the same size
+        if(s->count == STEADY_KEPT) {
+            for(s->count = 0; s->count < STEADY_KEPT/2; s->count++)
+                s->means[s->count] = (s->means[2*s->count] + s->means[2*s->count+1])/2;
+            s->batch *= 2;
+        }
+    }
+    if(++s->seen >= s->check)
+        return steady_check(s);
+    return 0;
+}
+
+#endif // STEADY_H_INCLUDED
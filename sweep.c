@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sweep.h"
+#include "vsim.h"
+#include "replicate.h"
+
+//Most values one axis may take
+#define AXIS_MAX 100000
+
+static int   _sweeper(void* rows, int point, vsimctx* ctx, simresult* scratch);
+static void  _keep(sweeprow* row, simresult* res);
+
+//An axis is a single value, a comma separated list or a start:stop:step
+//range with the stop included
+int sweep_axis(const char* spec, sweepaxis* a) {
+    double start, stop, step;
+    char*  end;
+    const char* p;
+    int    n, i;
+
+    a->values = NULL;
+    a->args   = NULL;
+    a->count  = 0;
+    if(spec == NULL)
+        return -1;
+    if(strchr(spec, ':')) {
+        if(sscanf(spec, "%lf:%lf:%lf", &start, &stop, &step) != 3 || step <= 0 || stop < start)
+            return -1;
+        //Slack keeps a stop that is a whole number of steps away
+        n = (int)floor((stop-start)/step + 1e-9) + 1;
+        if(n > AXIS_MAX || (a->values = (double*)malloc(n*sizeof(double))) == NULL)
+            return -1;
+        for(i = 0; i < n; i++)
+            a->values[i] = start + i*step;
+        a->count = n;
+        return 0;
+    }
+    for(n = 1, p = spec; *p; p++)
+        n += (*p == ',');
+    if(n > AXIS_MAX || (a->values = (double*)malloc(n*sizeof(double))) == NULL)
+        return -1;
+    for(i = 0, p = spec; i < n; i++) {
+        a->values[i] = strtod(p, &end);
+        if(end == p || (*end != ',' && *end != '\0')) {
+            free_sweep_axis(a);
+            return -1;
+        }
+        p = end + 1;
+    }
+    a->count = n;
+    return 0;
+}
+
+//Disciplines are a comma separated list of names, each one may carry
+//its own argument
+int sweep_modes(const char* spec, sweepaxis* a) {
+    char        name[64];
+    const char* p;
+    cqmode      m;
+    size_t      len;
+    int         n, i;
+
+    a->values = NULL;
+    a->args   = NULL;
+    a->count  = 0;
+    if(spec == NULL)
+        return -1;
+    for(n = 1, p = spec; *p; p++)
+        n += (*p == ',');
+    if(n > AXIS_MAX)
+        return -1;
+    a->values = (double*)malloc(n*sizeof(double));
+    a->args   = (double*)malloc(n*sizeof(double));
+    if(a->values == NULL || a->args == NULL) {
+        free_sweep_axis(a);
+        return -1;
+    }
+    for(i = 0, p = spec; i < n; i++) {
+        len = strcspn(p, ",");
+        if(len >= sizeof(name)) {
+            free_sweep_axis(a);
+            return -1;
+        }
+        memcpy(name, p, len);
+        name[len] = '\0';
+        if(cqmode_parse(name, &m, &a->args[i])) {
+            free_sweep_axis(a);
+            return -1;
+        }
+        a->values[i] = m;
+        p += len + 1;
+    }
+    a->count = n;
+    return 0;
+}
+
+void free_sweep_axis(sweepaxis* a) {
+    free(a->values);
+    free(a->args);
+    a->values = NULL;
+    a->args   = NULL;
+    a->count  = 0;
+    return;
+}
+
+//Every combination of the axes, lambda varying fastest
+sweeprow* sweep_grid(simconfig* base, sweepaxis* l, sweepaxis* m, sweepaxis* n,
+                     sweepaxis* s, int* count) {
+    sweeprow* rows;
+    long total = (long)l->count*m->count*n->count*s->count;
+    int  i, j, k, q, r = 0;
+
+    if(total <= 0 || total > (1L << 24))
+        return NULL;
+    if((rows = (sweeprow*)calloc(total, sizeof(sweeprow))) == NULL)
+        return NULL;
+    for(q = 0; q < s->count; q++)
+    for(k = 0; k < n->count; k++)
+    for(j = 0; j < m->count; j++)
+    for(i = 0; i < l->count; i++, r++) {
+        rows[r].config         = *base;
+        rows[r].config.lambda  = l->values[i];
+        rows[r].config.mu      = m->values[j];
+        rows[r].config.servers = (int)n->values[k];
+        simconfig_mode(&rows[r].config, (cqmode)s->values[q], s->args ? s->args[q] : 0);
+    }
+    *count = (int)total;
+    return rows;
+}
+
+//Points run on the shared worker pool, each worker's scratch result is
+//sized for the most servers any point asks for
+int sweep(sweeprow* rows, int count, int threads) {
+    int i, servers = 1;
+    for(i = 0; i < count; i++)
+        if(rows[i].config.servers > servers)
+            servers = rows[i].config.servers;
+    return run_pool(_sweeper, rows, count, servers, threads);
+}
+
+int _sweeper(void* arg, int i, vsimctx* ctx, simresult* res) {
+    sweeprow* row = (sweeprow*)arg + i;
+    if(vsim_run_in(ctx, &row->config, res))
+        return -1;
+    _keep(row, res);
+    return 0;
+}
+
+void _keep(sweeprow* row, simresult* res) {
+    double u = 0;
+    int i;
+    for(i = 0; i < row->config.servers; i++)
+        u += res->utilized[i];
+    row->analyzed    = res->analyzed;
+    row->elapsed     = res->elapsed;
+    row->utilized    = u/row->config.servers;
+    row->qlen_avg    = res->qlen_avg;
+    row->qlen_sigma  = res->qlen_sigma;
+    row->wait_avg    = res->wait_avg;
+    row->wait_sigma  = res->wait_sigma;
+    row->wait_pct[0] = tally_quantile(res->wait, 0.5);
+    row->wait_pct[1] = tally_quantile(res->wait, 0.9);
+    row->wait_pct[2] = tally_quantile(res->wait, 0.99);
+    row->wait_pct[3] = tally_quantile(res->wait, 0.999);
+    row->sojourn_avg = tally_mean(res->sojourn);
+    row->sojourn_p99 = tally_quantile(res->sojourn, 0.99);
+    row->warmup      = res->warmup;
+    row->wait_steady = res->wait_steady;
+    row->wait_ci95   = res->wait_ci95;
+}
@@ -0,0 +1,38 @@
+#ifndef SWEEP_H_INCLUDED
+#define SWEEP_H_INCLUDED
+
+#include "sim.h"
+
+//Structure for one axis of a sweep grid
+typedef struct _sweepaxis {
+    double*          values;          //Values the axis takes, in order
+    double*          args;            //Argument given with each value (NULL unless disciplines)
+    int              count;           //Number of values
+} sweepaxis;
+
+//Structure for one point of a sweep and the figures kept from its run
+typedef struct _sweeprow {
+    simconfig        config;          //Configuration of the point
+    int              analyzed;        //Number of customers analyzed
+    double           elapsed;         //Simulated seconds elapsed
+    double           utilized;        //Average server utilization (percent)
+    double           qlen_avg;        //Time weighted average queue length
+    double           qlen_sigma;      //Time weighted standard deviation of queue length
+    double           wait_avg;        //Average waiting time
+    double           wait_sigma;      //Standard deviation of waiting time
+    double           wait_pct[4];     //Waiting time p50, p90, p99 and p99.9
+    double           sojourn_avg;     //Average time in the system
+    double           sojourn_p99;     //99th percentile of time in the system
+    long             warmup;          //Customers deleted as warm-up (adaptive runs)
+    double           wait_steady;     //Average waiting time past the warm-up (adaptive runs)
+    double           wait_ci95;       //95% half width of wait_steady (adaptive runs)
+} sweeprow;
+
+int       sweep_axis(const char* spec, sweepaxis* axis);
+int       sweep_modes(const char* spec, sweepaxis* axis);
+void      free_sweep_axis(sweepaxis* axis);
+sweeprow* sweep_grid(simconfig* base, sweepaxis* lambda, sweepaxis* mu, sweepaxis* servers,
+                     sweepaxis* modes, int* count);
+int       sweep(sweeprow* rows, int count, int threads);
+
+#endif // SWEEP_H_INCLUDED
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tally.h"
+
+static double _bucket_low(int b);
+
+tally* new_tally(void) {
+    tally* t = (tally*)malloc(sizeof(tally));
+    if(t != NULL)
+        tally_init(t);
+    return t;
+}
+
+void destroy_tally(tally* t) {
+    free(t);
+    return;
+}
+
+void tally_init(tally* t) {
+    memset(t, 0, sizeof(tally));
+}
+
+//Chan's pairwise update combines the moments, buckets simply add up
+void tally_merge(tally* a, const tally* b) {
+    double d, n;
+    int i;
+    if(b->count == 0)
+        return;
+    if(a->count == 0 || b->min < a->min) a->min = b->min;
+    if(a->count == 0 || b->max > a->max) a->max = b->max;
+    n = (double)a->count + b->count;
+    d = b->mean - a->mean;
+    a->mean += d*b->count/n;
+    a->m2   += b->m2 + d*d*((double)a->count*b->count/n);
+    a->count += b->count;
+    for(i = 0; i < TALLY_BUCKETS; i++)
+        a->buckets[i] += b->buckets[i];
+}
+
+double tally_mean(const tally* t) {
+    return t->mean;
+}
+
+double tally_sigma(const tally* t) {
+    if(t->count < 2)
+        return 0;
+    return sqrt(t->m2/(t->count - 1));
+}
+
+//Middle of the bucket holding the q-th value, which is within half a
+//bucket (under 1% relative) of the exact order statistic
+double tally_quantile(const tally* t, double q) {
+    unsigned long rank, seen = 0;
+    double v;
+    int b;
+    if(t->count == 0)
+        return 0;
+    rank = (unsigned long)ceil(q*t->count);
+    if(rank < 1) rank = 1;
+    if(rank > t->count) rank = t->count;
+    for(b = 0; b < TALLY_BUCKETS - 1; b++) {
+        seen += t->buckets[b];
+        if(seen >= rank)
+            break;
+    }
+    if(b == 0)
+        v = 0;
+    else
+        v = 0.5*(_bucket_low(b) + _bucket_low(b+1));
+    //Never report past what was actually seen
+    if(v < t->min) v = t->min;
+    if(v > t->max) v = t->max;
+    return v;
+}
+
+double _bucket_low(int b) {
+    union {double d; unsigned long u;} v;
+    v.u = ((unsigned long)(b - 1) + ((unsigned long)TALLY_EXPMIN << TALLY_SUBBITS)) << (52 - TALLY_SUBBITS);
+    return v.d;
+}
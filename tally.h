@@ -0,0 +1,61 @@
+#ifndef TALLY_H_INCLUDED
+#define TALLY_H_INCLUDED
+
+//Log bucket layout: every power of two from 2^-30 (about a nanosecond)
+//up to 2^22 (about 48 days) is split in TALLY_SUB equal buckets, so a
+//bucket is never wider than 1/TALLY_SUB of the values in it
+#define TALLY_SUBBITS  6
+#define TALLY_SUB      (1 << TALLY_SUBBITS)
+#define TALLY_EXPMIN   (1023 - 30)
+#define TALLY_OCTAVES  52
+#define TALLY_BUCKETS  (1 + TALLY_OCTAVES*TALLY_SUB)
+
+//Structure for a streaming tally of a non-negative quantity. Moments are
+//kept with Welford's update and quantiles come from a fixed log bucketed
+//histogram, so adding a value is O(1), memory is constant and two tallies
+//kept by different threads can be merged into one.
+typedef struct _tally {
+    unsigned long    count;           //Number of values tallied
+    double           mean;            //Running mean
+    double           m2;              //Running sum of squared deviations from the mean
+    double           min;             //Smallest value tallied
+    double           max;             //Largest value tallied
+    unsigned long    buckets[TALLY_BUCKETS]; //Bucket 0 holds zero and anything below 2^-30
+} tally;
+
+tally* new_tally(void);
+void   destroy_tally(tally* t);
+void   tally_init(tally* t);
+void   tally_merge(tally* into, const tally* from);
+double tally_mean(const tally* t);
+double tally_sigma(const tally* t);
+double tally_quantile(const tally* t, double q);
+
+//Bucket a value falls in, read straight off its exponent and top
+//mantissa bits
+static inline int tally_bucket(double x) {
+    union {double d; unsigned long u;} v;
+    long b;
+    v.d = x;
+    if(!(x > 0))
+        return 0;
+    b = (long)(v.u >> (52 - TALLY_SUBBITS)) - ((long)TALLY_EXPMIN << TALLY_SUBBITS);
+    if(b < 0)
+        return 0;
+    if(b >= TALLY_BUCKETS - 1)
+        return TALLY_BUCKETS - 1;
+    return (int)b + 1;
+}
+
+//Add one value
+static inline void tally_add(tally* t, double x) {
+    double d = x - t->mean;
+    t->count++;
+    t->mean += d/t->count;
+    t->m2   += d*(x - t->mean);
+    if(t->count == 1 || x < t->min) t->min = x;
+    if(t->count == 1 || x > t->max) t->max = x;
+    t->buckets[tally_bucket(x)]++;
+}
+
+#endif // TALLY_H_INCLUDED
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+#define TRACE_MAGIC   "iQtrace"
+#define TRACE_VERSION 1
+//Output buffer of a trace writer
+#define TRACE_BUFFER  (1 << 20)
+
+static int           _put_varint(FILE* f, unsigned long v);
+static unsigned long _count_varint(const unsigned char* p, const unsigned char* end);
+
+tracewriter* trace_create(const char* path, traceformat format) {
+    tracewriter* w = (tracewriter*)malloc(sizeof(tracewriter));
+    tracehead    h;
+    if(w == NULL)
+        return NULL;
+    if((w->file = fopen(path, "wb")) == NULL) {
+        free(w);
+        return NULL;
+    }
+    setvbuf(w->file, NULL, _IOFBF, TRACE_BUFFER);
+    w->format = format;
+    w->count  = 0;
+    //Count is patched in once the writer is closed
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    h.version = TRACE_VERSION;
+    h.format  = format;
+    h.count   = 0;
+    if(fwrite(&h, sizeof(h), 1, w->file) != 1) {
+        fclose(w->file);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+int trace_write(tracewriter* w, double delta, double job) {
+    unsigned long r[2];
+    r[0] = (unsigned long)llround(delta*1e9);
+    r[1] = (unsigned long)llround(job*1e9);
+    w->count++;
+    if(w->format == TRACE_FIXED)
+        return (fwrite(r, sizeof(r), 1, w->file) == 1) ? 0 : -1;
+    return (_put_varint(w->file, r[0]) || _put_varint(w->file, r[1])) ? -1 : 0;
+}
+
+int trace_close(tracewriter* w) {
+    int status = 0;
+    if(w == NULL)
+        return 0;
+    //Write errors stick to the stream, they show up here
+    if(ferror(w->file) || fseek(w->file, offsetof(tracehead, count), SEEK_SET) ||
+       fwrite(&w->count, sizeof(w->count), 1, w->file) != 1)
+        status = -1;
+    if(fclose(w->file))
+        status = -1;
+    free(w);
+    return status;
+}
+
+//Map the whole file read-only, the kernel pages it in ahead of the
+//cursors since they only ever move forward
+tracemap* trace_open(const char* path) {
+    tracemap*   m;
+    tracehead   h;
+    struct stat st;
+    int         fd;
+    if((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if(fstat(fd, &st) || st.st_size < (off_t)sizeof(tracehead) ||
+       (m = (tracemap*)malloc(sizeof(tracemap))) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    m->size = st.st_size;
+    m->path = NULL;
+    m->base = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(m->base == MAP_FAILED) {
+        free(m);
+        return NULL;
+    }
+    memcpy(&h, m->base, sizeof(h));
+    if(memcmp(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) || h.version != TRACE_VERSION ||
+       h.format > TRACE_VARINT) {
+        trace_unmap(m);
+        return NULL;
+    }
+    madvise(m->base, m->size, MADV_SEQUENTIAL);
+    if((m->path = strdup(path)) == NULL) {
+        trace_unmap(m);
+        return NULL;
+    }
+    m->format = (traceformat)h.format;
+    m->count  = h.count;
+    //A writer that never closed left no count, recover it from the records
+    if(m->count == 0 && m->format == TRACE_FIXED)
+        m->count = (m->size - sizeof(tracehead))/(2*sizeof(unsigned long));
+    else if(m->count == 0)
+        m->count = _count_varint((unsigned char*)m->base + sizeof(tracehead),
+                                 (unsigned char*)m->base + m->size);
+    return m;
+}
+
+void trace_unmap(tracemap* m) {
+    if(m == NULL)
+        return;
+    munmap(m->base, m->size);
+    free(m->path);
+    free(m);
+    return;
+}
+
+void trace_cursor(tracemap* m, tracecur* c) {
+    c->pos    = (const unsigned char*)m->base + sizeof(tracehead);
+    c->end    = (const unsigned char*)m->base + m->size;
+    c->format = m->format;
+}
+
+//Mean interarrival time and job over the first n records, which is what
+//a replay of n customers goes through. Returns -1 if there are none.
+int trace_means(tracemap* m, unsigned long n, double* delta, double* job) {
+    tracecur      c;
+    double        d, j, sd = 0, sj = 0;
+    unsigned long k;
+    trace_cursor(m, &c);
+    for(k = 0; k < n && trace_next(&c, &d, &j); k++) {
+        sd += d;
+        sj += j;
+    }
+    if(k == 0)
+        return -1;
+    *delta = sd/k;
+    *job   = sj/k;
+    return 0;
+}
+
+int _put_varint(FILE* f, unsigned long v) {
+    unsigned char b[10];
+    int n = 0;
+    do {
+        b[n] = v & 0x7F;
+        v >>= 7;
+        if(v) b[n] |= 0x80;
+        n++;
+    } while(v);
+    return (fwrite(b, 1, n, f) == (size_t)n) ? 0 : -1;
+}
+
+//Every varint ends in the one byte with the high bit clear
+unsigned long _count_varint(const unsigned char* p, const unsigned char* end) {
+    unsigned long n = 0;
+    for(; p < end; p++)
+        n += !(*p & 0x80);
+    return n/2;
+}
@@ -0,0 +1,87 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdio.h>
+#include <string.h>
+
+//Record encodings, delta and job are nanoseconds either way
+enum _traceformat {TRACE_FIXED = 0, TRACE_VARINT = 1};
+
+//Misc Typedefs
+typedef enum   _traceformat traceformat;
+
+//Structure for the header at the start of every trace file. Records
+//follow right after it: two 64 bit words each (fixed) or two LEB128
+//varints each (varint), the time since the previous arrival and the job.
+typedef struct _tracehead {
+    char             magic[8];        //"iQtrace" and a zero
+    unsigned int     version;         //Layout version of the file
+    unsigned int     format;          //Record encoding
+    unsigned long    count;           //Number of records (0 if the writer never closed)
+} tracehead;
+
+//Structure for writing a trace
+typedef struct _tracewriter {
+    FILE*            file;            //Buffered output file
+    enum _traceformat format;         //Record encoding
+    unsigned long    count;           //Number of records written
+} tracewriter;
+
+//Structure for a trace mapped in for replay, shared read-only by every
+//cursor walking it
+typedef struct _tracemap {
+    void*            base;            //Start of the mapping
+    size_t           size;            //Length of the mapping
+    enum _traceformat format;         //Record encoding
+    unsigned long    count;           //Number of records
+    char*            path;            //File the trace was mapped from
+} tracemap;
+
+//Structure for walking the records of a mapped trace
+typedef struct _tracecur {
+    const unsigned char* pos;         //Next record
+    const unsigned char* end;         //End of the records
+    enum _traceformat    format;      //Record encoding
+} tracecur;
+
+tracewriter* trace_create(const char* path, traceformat format);
+int          trace_write(tracewriter* w, double delta, double job);
+int          trace_close(tracewriter* w);
+tracemap*    trace_open(const char* path);
+void         trace_unmap(tracemap* m);
+void         trace_cursor(tracemap* m, tracecur* c);
+int          trace_means(tracemap* m, unsigned long n, double* delta, double* job);
+
+//Next varint of a record, stopping at the end of a truncated trace
+static inline unsigned long trace_varint(tracecur* c) {
+    unsigned long v = 0;
+    unsigned char b = 0x80;
+    int s = 0;
+    while((b & 0x80) && c->pos < c->end) {
+        b  = *c->pos++;
+        v |= (unsigned long)(b & 0x7F) << s;
+        s += 7;
+    }
+    return v;
+}
+
+//Next record straight out of the mapping, 0 once the trace runs out
+static inline int trace_next(tracecur* c, double* delta, double* job) {
+    unsigned long r[2];
+    if(c->format == TRACE_FIXED) {
+        if(c->end - c->pos < (long)sizeof(r))
+            return 0;
+        memcpy(r, c->pos, sizeof(r));
+        c->pos += sizeof(r);
+    } else {
+        if(c->pos >= c->end)
+            return 0;
+        r[0] = trace_varint(c);
+        r[1] = trace_varint(c);
+    }
+    *delta = r[0]*1e-9;
+    *job   = r[1]*1e-9;
+    return 1;
+}
+
+#endif // TRACE_H_INCLUDED
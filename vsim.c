@@ -0,0 +1,317 @@
+#include <math.h>
+#include <string.h>
+#include "vsim.h"
+#include "rng.h"
+
+//Virtual clock helpers
+static long    _vns(double seconds);
+static double  _vclock(void* now);
+static void    _vstart(vsimctx* x, int server, cid c, double quantum);
+static void    _vdepart(vsimctx* x, simresult* res, int server);
+
+vsimctx* new_vsimctx(void) {
+    return (vsimctx*)calloc(1, sizeof(vsimctx));
+}
+
+void destroy_vsimctx(vsimctx* x) {
+    int i;
+    if(x == NULL)
+        return;
+    for(i = 0; i < CQ_MODES; i++)
+        if(x->live[i])
+            destroy_cqueue(x->live[i]);
+    //Destroying an evlist or a simbusy that was never set up is fine
+    evlist_free(&x->events);
+    simbusy_free(&x->busy);
+    destroy_carena(x->arena);
+    free(x->idle);
+    free(x->current);
+    free(x->slice);
+    free(x->ends);
+    destroy_steady(x->steady);
+    free(x);
+    return;
+}
+
+int vsim_run(simconfig* cfg, simresult* res) {
+    vsimctx* x = new_vsimctx();
+    int status;
+    if(x == NULL)
+        return -1;
+    status = vsim_run_in(x, cfg, res);
+    destroy_vsimctx(x);
+    return status;
+}
+
+int vsim_run_in(vsimctx* x, simconfig* cfg, simresult* res) {
+    evlist*        events;
+    event          e;
+    cqueue*        live;    //Stores unserviced customers
+    const cqdisc*  disc;    //Discipline of the live queue
+    carena*        arena;   //Every customer of the run, column by column
+    cid            c;
+    cid*           current; //Customer each server is working on
+    rng            random;
+    rng            classes; //Priority classes, drawn apart so the workload stays the same
+    expblock       draws;   //Unit exponentials generated a block at a time
+    tracecur       cursor;  //Position in the trace being replayed
+    profcur        pace;    //Position in the arrival rate profile
+    double         delta = 0, job = 0; //Interarrival time and job of the next arrival
+    int*           idle;    //Stack of idle servers
+    int            i, nidle, status = 0, generated = 0;
+    double         now = 0, last = 0, rank, done;
+
+    if(x == NULL || cfg == NULL || res == NULL || res->servers < cfg->servers ||
+       cfg->mode < FIFO || cfg->mode >= CQ_MODES || cfg->mode == RING)
+        return -1;
+
+    //One pending arrival plus at most one departure per server, sized
+    //up only when a run needs more servers than the last
+    if(x->servers < cfg->servers) {
+        evlist_free(&x->events);
+        simbusy_free(&x->busy);
+        free(x->idle);
+        free(x->current);
+        free(x->slice);
+        free(x->ends);
+        x->servers = 0;
+        x->idle    = (int*)malloc(cfg->servers*sizeof(int));
+        x->current = (cid*)malloc(cfg->servers*sizeof(cid));
+        x->slice   = (double*)malloc(cfg->servers*sizeof(double));
+        x->ends    = (double*)malloc(cfg->servers*sizeof(double));
+        if(evlist_init(&x->events, cfg->servers + 1) || simbusy_init(&x->busy, cfg->servers) ||
+           !x->idle || !x->current || !x->slice || !x->ends)
+            return -1;
+        x->servers = cfg->servers;
+    }
+    //Room for every customer the run generates, an arena too small is
+    //swapped for a bigger one between runs while it holds nobody
+    if(x->arena == NULL || (int)x->arena->capacity < cfg->customers) {
+        for(i = 0; i < CQ_MODES; i++) {
+            destroy_cqueue(x->live[i]);
+            x->live[i] = NULL;
+        }
+        destroy_carena(x->arena);
+        if((x->arena = new_carena((cfg->customers > 0) ? cfg->customers : 1)) == NULL)
+            return -1;
+    }
+    if(x->live[cfg->mode] == NULL && (x->live[cfg->mode] = new_cqueue(cfg->mode, x->arena)) == NULL)
+        return -1;
+    if(cfg->precision > 0 && x->steady == NULL && (x->steady = new_steady()) == NULL)
+        return -1;
+    if(x->steady != NULL)
+        steady_init(x->steady, cfg->precision);
+    x->stopped = 0;
+    x->profile = cfg->profile;
+    x->disc    = x->live[cfg->mode]->disc;
+    events  = &x->events;
+    live    = x->live[cfg->mode];
+    disc    = live->disc;
+    arena   = x->arena;
+    idle    = x->idle;
+    current = x->current;
+    events->count = 0;
+    events->seq   = 0;
+    simbusy_clear(&x->busy, cfg->servers);
+    //The live queue integrates its own length over simulated time
+    x->now = 0;
+    if(cqueue_account(live, _vclock, &x->now))
+        return -1;
+
+    //Stream 0 is the one genesis() draws, so a given -R reproduces the
+    //workload the wall-clock threads would see. Classes come from the
+    //same stream far past anything the workload draws.
+    rng_seed(&random, (unsigned long)cfg->rseed, cfg->stream);
+    classes = random;
+    rng_skip(&classes, 1UL << 62);
+    expblock_init(&draws, &random);
+
+    //Server 0 ends up on top of the idle stack
+    for(i = 0; i < cfg->servers; i++) {
+        res->utilized[i] = 0;
+        res->served[i]   = 0;
+        idle[i]    = cfg->servers-1-i;
+        current[i] = CID_NONE;
+    }
+    res->worked   = 0;
+    res->analyzed = 0;
+    tally_init(res->wait);
+    tally_init(res->sojourn);
+    memset(res->windows, 0, PROFILE_WINDOWS*sizeof(winstat));
+    nidle = cfg->servers;
+
+    //First customer arrives as soon as the simulation starts, or when
+    //the trace being replayed says so
+    if(cfg->replay) {
+        trace_cursor(cfg->replay, &cursor);
+        if(cfg->customers > 0 && trace_next(&cursor, &delta, &job))
+            evlist_push(events, delta, ARRIVAL, -1);
+    } else if(cfg->profile && cfg->customers > 0) {
+        //Or the first moment the profile has any arrivals at all
+        profile_cursor(&pace);
+        delta = profile_next(cfg->profile, &pace, 0);
+        evlist_push(events, delta, ARRIVAL, -1);
+    } else if(cfg->customers > 0) {
+        evlist_push(events, 0, ARRIVAL, -1);
+    }
+
+    while(evlist_pop(events, &e)) {
+        now = x->now = e.time;
+        //Queue length held since the last event, window by window
+        if(cfg->profile)
+            profile_integrate(cfg->profile, res->windows, last, now, live->count);
+        last = now;
+        switch(e.type) {
+            case ARRIVAL:
+                //The precision is there, whoever is in the system finishes
+                if(x->stopped)
+                    break;
+                //Get a blank customer and initialize it
+                c = carena_get(arena);
+                if(c == CID_NONE) {
+                    //Out of memory, abandon the run
+                    events->count = 0;
+                    status = -1;
+                    break;
+                }
+                arena->born[c] = _vns(now);
+                arena->job[c]  = cfg->replay ? job : dist_next(cfg->service, &draws)/cfg->mu;
+                arena->left[c] = arena->job[c];
+                arena->prio[c] = (cfg->classes > 1) ? (int)(rng_uniform(&classes)*cfg->classes) : 0;
+                encqueue(live, c);
+                if(cfg->record && trace_write(cfg->record, delta, arena->job[c]))
+                    status = -1;
+
+                //Schedule next customer
+                if(++generated >= cfg->customers)
+                    break;
+                if(cfg->replay) {
+                    if(trace_next(&cursor, &delta, &job))
+                        evlist_push(events, now + delta, ARRIVAL, -1);
+                } else if(cfg->profile) {
+                    //Interarrival draws count expected arrivals under the profile
+                    done  = profile_next(cfg->profile, &pace, dist_next(cfg->arrivals, &draws));
+                    delta = done - now;
+                    evlist_push(events, done, ARRIVAL, -1);
+                } else {
+                    delta = dist_next(cfg->arrivals, &draws)/cfg->lambda;
+                    evlist_push(events, now + delta, ARRIVAL, -1);
+                }
+                break;
+            case DEPARTURE:
+                //The slice is over, a customer still owed service goes
+                //to the back of the line
+                i = e.server;
+                c = current[i];
+                _vdepart(x, res, i);
+                idle[nidle++] = i;
+                if(arena->left[c] > 0)
+                    encqueue(live, c);
+                else
+                    carena_put(arena, c);
+                break;
+        }
+
+        //A waiting customer outranking the worst running one takes its
+        //server, the running one goes back in line with what it is owed
+        while(disc->rank && nidle == 0 && (c = cqueue_peek(live)) != CID_NONE) {
+            i = sim_victim(&x->busy, disc, arena, current, x->slice, x->ends, now, &rank);
+            if(i < 0 || disc->rank(arena, c, arena->left[c]) >= rank)
+                break;
+            done = x->slice[i] - (x->ends[i] - now);
+            x->slice[i] = done;
+            c = current[i];
+            evlist_cancel(events, i);
+            _vdepart(x, res, i);
+            idle[nidle++] = i;
+            if(arena->left[c] > 0)
+                encqueue(live, c);
+            else
+                carena_put(arena, c);
+        }
+
+        //Hand waiting customers to idle servers
+        while(nidle > 0 && live->count > 0)
+            _vstart(x, idle[--nidle], decqueue(live), cfg->quantum);
+    }
+
+    //Work totals become utilization percentages
+    res->elapsed = now;
+    for(i = 0; i < cfg->servers; i++)
+        res->utilized[i] = (now > 0) ? 100*res->utilized[i]/now : 0;
+    cqueue_length_stats(live, &res->qlen_avg, &res->qlen_sigma, res->qlen_share);
+    res->wait_avg   = tally_mean(res->wait);
+    res->wait_sigma = tally_sigma(res->wait);
+    res->warmup      = 0;
+    res->wait_steady = 0;
+    res->wait_ci95   = 0;
+    res->converged   = 0;
+    if(cfg->precision > 0) {
+        steady_check(x->steady);
+        res->warmup      = x->steady->warmup;
+        res->wait_steady = x->steady->mean;
+        res->wait_ci95   = x->steady->half;
+        res->converged   = x->stopped;
+    }
+
+    //An abandoned run leaves customers behind, the next run starts empty
+    while((c = decqueue(live)) != CID_NONE)
+        carena_put(arena, c);
+    for(i = 0; i < cfg->servers; i++)
+        if(current[i] != CID_NONE)
+            carena_put(arena, current[i]);
+    return status;
+}
+
+//Put a customer on a server for as much of what it is owed as the
+//quantum allows, all of it without one
+void _vstart(vsimctx* x, int i, cid c, double quantum) {
+    double left = x->arena->left[c];
+    x->current[i] = c;
+    x->slice[i]   = (quantum > 0 && left > quantum) ? quantum : left;
+    x->ends[i]    = x->now + x->slice[i];
+    evlist_push(&x->events, x->ends[i], DEPARTURE, i);
+    if(x->disc->rank)
+        simbusy_add(&x->busy, i, sim_key(x->disc, x->arena, c, x->slice[i], x->ends[i]));
+}
+
+//Take the customer off a server once its slice is served, tallying it
+//if that was the last of its job
+void _vdepart(vsimctx* x, simresult* res, int i) {
+    carena*   a = x->arena;
+    cid       c = x->current[i];
+    winstat*  w;
+    double    t;
+    x->current[i]    = CID_NONE;
+    simbusy_remove(&x->busy, i);
+    res->worked      += x->slice[i];
+    res->utilized[i] += x->slice[i];
+    a->left[c] = (x->slice[i] < a->left[c]) ? a->left[c] - x->slice[i] : 0;
+    if(a->left[c] > 0)
+        return;
+    //Waits shorter than the clock's nanosecond are none at all, the time
+    //of death is only ever needed here so it is not kept
+    t = (_vns(x->now) - a->born[c])/1e9;
+    t = (t - a->job[c] < 1e-9) ? 0 : t - a->job[c];
+    res->analyzed++;
+    res->served[i]++;
+    tally_add(res->wait, t);
+    tally_add(res->sojourn, t + a->job[c]);
+    if(x->profile != NULL) {
+        w = &res->windows[profile_window(x->profile, a->born[c]/1e9)];
+        w->arrived++;
+        w->wait += t;
+    }
+    if(x->steady != NULL && !x->stopped && x->steady->target > 0)
+        x->stopped = steady_add(x->steady, t);
+}
+
+long _vns(double s) {
+    //Stamps share the wall clock's nanosecond resolution, a customer served
+    //the moment it arrives waits exactly zero
+    return (long)llround(s*1e9);
+}
+
+double _vclock(void* now) {
+    return *(double*)now;
+}
@@ -0,0 +1,33 @@
+#ifndef VSIM_H_INCLUDED
+#define VSIM_H_INCLUDED
+
+#include "sim.h"
+#include "evlist.h"
+#include "steady.h"
+
+//Structure for the working state of the virtual time engine. A context
+//is reused from run to run by one thread, so back to back runs don't
+//pay for queues, arenas and event lists again.
+typedef struct _vsimctx {
+    struct _evlist   events;          //Future event list
+    struct _cqueue*  live[CQ_MODES];  //Live queue of each mode, made on first use
+    struct _carena*  arena;           //Customers of the runs, made on the first run and grown between runs
+    int*             idle;            //Stack of idle servers
+    cid*             current;         //Customer each server is working on (CID_NONE when idle)
+    double*          slice;           //Service the running slice of each server covers
+    double*          ends;            //Time the running slice of each server ends
+    struct _simbusy  busy;            //Busy servers by their customer's preemption rank
+    int              servers;         //Number of servers events and idle are sized for
+    double           now;             //Simulated clock, read by the live queue accounting
+    struct _steady*  steady;          //Steady state wait estimate, made on the first adaptive run
+    int              stopped;         //Precision reached, no more arrivals
+    const struct _profile* profile;   //Arrival rate profile of the current run (NULL when constant)
+    const struct _cqdisc*  disc;      //Discipline of the current run's live queue
+} vsimctx;
+
+vsimctx* new_vsimctx(void);
+void     destroy_vsimctx(vsimctx* ctx);
+int      vsim_run_in(vsimctx* ctx, simconfig* config, simresult* result);
+int      vsim_run(simconfig* config, simresult* result);
+
+#endif // VSIM_H_INCLUDED